@@ -1311,6 +1311,16 @@ void __init at91_set_serial_console(unsigned portnr)
 		atmel_default_console_device = at91_uarts[portnr];
 }
 
+void __init at91_set_uart_rs485(unsigned portnr, const struct serial_rs485 *rs485)
+{
+	struct atmel_uart_data *data;
+
+	if (portnr < ATMEL_MAX_UART && at91_uarts[portnr]) {
+		data = at91_uarts[portnr]->dev.platform_data;
+		data->rs485 = *rs485;
+	}
+}
+
 void __init at91_add_device_serial(void)
 {
 	int i;
@@ -1329,6 +1339,7 @@ void __init at91_add_device_serial(void)
 #else
 void __init at91_register_uart(unsigned id, unsigned portnr, unsigned pins) {}
 void __init at91_set_serial_console(unsigned portnr) {}
+void __init at91_set_uart_rs485(unsigned portnr, const struct serial_rs485 *rs485) {}
 void __init at91_add_device_serial(void) {}
 #endif
 
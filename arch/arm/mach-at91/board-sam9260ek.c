@@ -49,6 +49,14 @@
 #include "generic.h"
 
 
+/*
+ * RS485 bus on US0: the USART drives RTS as transmit enable
+ */
+static struct serial_rs485 __initdata ek_rs485 = {
+	.flags			= SER_RS485_ENABLED,
+	.delay_rts_after_send	= 0,		/* bit periods (TTGR) */
+};
+
 static void __init ek_map_io(void)
 {
 	/* Initialize processor: 25.000 MHz crystal */
@@ -61,6 +69,7 @@ static void __init ek_map_io(void)
 	at91_register_uart(AT91SAM9260_ID_US0, 1, ATMEL_UART_CTS | ATMEL_UART_RTS
 			   | ATMEL_UART_DTR | ATMEL_UART_DSR | ATMEL_UART_DCD
 			   | ATMEL_UART_RI);
+	at91_set_uart_rs485(1, &ek_rs485);
 
 	/* COMA / ID1 / ttyS2. (Rx, Tx, RTS, CTS) */
 	at91_register_uart(AT91SAM9260_ID_US1, 2, ATMEL_UART_CTS | ATMEL_UART_RTS);
@@ -142,7 +151,11 @@ static void __init at73c213_set_clk(struct at73c213_board_info *info) {}
 static struct spi_board_info ek_spi_devices[] = {
 	{
 		/* IC8 and OC8 peripherals */
+#if defined(CONFIG_SPI_ICOC8) || defined(CONFIG_SPI_ICOC8_MODULE)
+		.modalias 	= "icoc8",
+#else
 		.modalias 	= "spidev",
+#endif
 		.chip_select	= 1,
 		.max_speed_hz 	= 15 * 1000 * 1000,
 		.bus_num	= 0,	
@@ -0,0 +1,117 @@
+/*
+ * linux/arch/arm/mach-at91/boardtype.c
+ *
+ * Kaba Access Manager board identification (AM-M / AM-L / AM300)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/proc_fs.h>
+
+#include <mach/hardware.h>
+#include <mach/at91_pio.h>
+#include <mach/at91_pmc.h>
+#include <mach/board.h>
+
+/* PIOC peripheral ID, the same on all AT91 parts with a PIOC */
+#define AT91_ID_PIOC	4
+
+#define BOARDTYPE_PINS	((1 << 30) | (1 << 31))	/* PC30, PC31 */
+
+static unsigned long board_type;
+
+/*
+ * Detect the board type from the strapping of the chip reset lines.
+ *
+ * Pin:		Value:	Board:			Remarks
+ * -------------------------------------------------------------------------
+ * [PIOC-31]	= 0	Access Manager MIFARE	Pull-Down on Security Chip
+ *		= 1	Access Manager LEGIC	Internal Pull-Up CPU
+ * [PIOC-30]	= 0	Access Manager LEGIC	Pull-Down on Legic Chip
+ *		= 1	AM300
+ *
+ * This runs from at91_clock_init(), before the GPIO banks are registered
+ * and before udelay() is calibrated, so the PIO is accessed directly.
+ */
+void __init at91_detect_platform_type(void)
+{
+	unsigned int pdsr = 0;
+	int i;
+
+	at91_sys_write(AT91_PMC_PCER, 1 << AT91_ID_PIOC);
+	at91_sys_write(AT91_PIOC + PIO_IDR, BOARDTYPE_PINS);
+	at91_sys_write(AT91_PIOC + PIO_PUER, BOARDTYPE_PINS);
+	at91_sys_write(AT91_PIOC + PIO_ODR, BOARDTYPE_PINS);
+	at91_sys_write(AT91_PIOC + PIO_PER, BOARDTYPE_PINS);
+
+	/* give the pull-ups some time to settle */
+	for (i = 0; i < 10000; i++)
+		pdsr = at91_sys_read(AT91_PIOC + PIO_PDSR);
+
+	if (pdsr & (1 << 31)) {
+		if (pdsr & (1 << 30))
+			board_type = AM3;	/* AM300 */
+		else
+			board_type = AML;	/* Access Manager LEGIC */
+	} else
+		board_type = AMM;		/* Access Manager MIFARE */
+}
+
+/*
+ * Return the board type detected at boot (AMM, AML or AM3).
+ */
+unsigned long at91_platform_type(void)
+{
+	return board_type;
+}
+EXPORT_SYMBOL(at91_platform_type);
+
+/*
+ * Return a printable name of the board type.
+ */
+const char *at91_platform_name(void)
+{
+	switch (board_type) {
+	case AMM:
+		return "AM-M";
+	case AML:
+		return "AM-L";
+	case AM3:
+		return "AM300";
+	default:
+		return "unknown";
+	}
+}
+EXPORT_SYMBOL(at91_platform_name);
+
+/*
+ * /proc/boardtype
+ */
+static int boardtype_read_proc(char *page, char **start, off_t off,
+			       int count, int *eof, void *data)
+{
+	int len;
+
+	if (off > 0) {
+		*eof = 1;
+		return 0;
+	}
+	len = sprintf(page, "%s\n", at91_platform_name());
+	*eof = 1;
+	return len;
+}
+
+static int __init boardtype_proc_init(void)
+{
+	if (!create_proc_read_entry("boardtype", 0444, NULL,
+				    boardtype_read_proc, NULL))
+		return -ENOMEM;
+	return 0;
+}
+late_initcall(boardtype_proc_init);
@@ -634,8 +634,8 @@ static struct clk *const standard_pmc_clocks[] __initdata = {
 /* PLLB generated USB full speed clock init */
 static void __init at91_pllb_usbfs_clock_init(unsigned long main_clock)
 {
-	char boardtype=0;
-	
+	char boardtype = at91_platform_type();
+
 	/*
 	 * USB clock init:  choose 48 MHz PLLB value,
 	 * disable 48MHz clock during usb peripheral suspend.
@@ -644,7 +644,6 @@ static void __init at91_pllb_usbfs_clock_init(unsigned long main_clock)
 	 */
 	uhpck.parent = &pllb;
 
-	boardtype = at91_platform_type();
 	if (boardtype == AMM)
 	{
 		at91_pllb_usb_init = at91_pll_calc(main_clock, 128000000);
@@ -710,6 +709,9 @@ int __init at91_clock_init(unsigned long main_clock)
 	int i;
 	int pll_overclock = false;
 
+	/* identify the board once, drivers use the cached value */
+	at91_detect_platform_type();
+
 	/*
 	 * When the bootloader initialized the main oscillator correctly,
 	 * there's no problem using the cycle counter.  But if it didn't,
@@ -46,6 +46,13 @@
 #include <linux/moduleparam.h>
 /* request_irq(), free_irq() */
 #include <linux/interrupt.h>
+/* wait queues, poll() and the client list */
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/sched.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
 
 /* needed for virt_to_phys() */
 #include <asm/io.h>
@@ -91,9 +98,6 @@ MODULE_DESCRIPTION("driver module for 8170/81990 Hantro decoder/pp");
 
 static const int DecHwId[] = { 0x8190, 0x8170, 0x9170, 0x9190 };
 
-static u32 hx_pp_instance = 0;
-static u32 hx_dec_instance = 0;
-
 unsigned long base_port = HXDEC_LOGIC_MODULE0_BASE;
 int irq = DEC_IRQ;
 
@@ -114,13 +118,43 @@ typedef struct
     int irq;
     struct fasync_struct *async_queue_dec;
     struct fasync_struct *async_queue_pp;
+
+    /* IRQ counters and the queues of the HX170DEC_IOCT_WAIT callers */
+    spinlock_t lock;
+    unsigned int dec_irqs;
+    unsigned int pp_irqs;
+    wait_queue_head_t dec_queue;
+    wait_queue_head_t pp_queue;
+
+    /* frame timing, see Hx170Timing */
+    ktime_t dec_start;
+    ktime_t pp_start;
+    int dec_timing;
+    int pp_timing;
+    Hx170Stats stats;
+
+    /* hardware reservation */
+    spinlock_t res_lock;
+    pid_t res_owner;            /* process holding the hardware, 0 = free */
+    int res_count;              /* its clients holding a reservation */
+    struct list_head res_waiters;
+    wait_queue_head_t res_queue;
 } hx170dec_t;
 
+/* one per open file */
+typedef struct
+{
+    int pp;                     /* the client is a pp instance */
+    pid_t pid;                  /* process that opened the device */
+    unsigned int seen;          /* IRQ count at the last wait */
+    int reserved;
+    int granted;
+    struct list_head res_list;  /* on res_waiters */
+} hx170dec_client;
+
 static hx170dec_t hx170dec_data;    /* dynamic allocation? */
 
-#ifdef HW_PERFORMANCE
 static struct timeval end_time;
-#endif
 
 static int ReserveIO(void);
 static void ReleaseIO(void);
@@ -145,14 +179,169 @@ static irqreturn_t hx170dec_isr(int irq, void *dev_id);
     Return type     : int
 ------------------------------------------------------------------------------*/
 
+/*------------------------------------------------------------------------------
+    Function name   : ReserveHw
+    Description     : Wait until the hardware is ours. Waiters are served in
+                      FIFO order; other clients of the reserving process get
+                      the hardware at once.
+
+    Return type     : int
+------------------------------------------------------------------------------*/
+
+static int ReserveHw(hx170dec_t * dev, hx170dec_client * client)
+{
+    int ret;
+
+    spin_lock(&dev->res_lock);
+    if(client->reserved)
+    {
+        spin_unlock(&dev->res_lock);
+        return 0;
+    }
+    if(dev->res_owner == 0 && list_empty(&dev->res_waiters))
+        dev->res_owner = client->pid;
+    if(dev->res_owner == client->pid)
+    {
+        dev->res_count++;
+        client->reserved = 1;
+        spin_unlock(&dev->res_lock);
+        return 0;
+    }
+    client->granted = 0;
+    list_add_tail(&client->res_list, &dev->res_waiters);
+    spin_unlock(&dev->res_lock);
+
+    ret = wait_event_interruptible(dev->res_queue, client->granted);
+
+    spin_lock(&dev->res_lock);
+    if(client->granted)
+    {
+        /* got it after all */
+        client->reserved = 1;
+        ret = 0;
+    }
+    else
+    {
+        list_del(&client->res_list);
+    }
+    spin_unlock(&dev->res_lock);
+
+    return ret;
+}
+
+/*------------------------------------------------------------------------------
+    Function name   : ReleaseHw
+    Description     : Give up a reservation, hand the hardware to the next
+                      waiting process.
+
+    Return type     : void
+------------------------------------------------------------------------------*/
+
+static void ReleaseHw(hx170dec_t * dev, hx170dec_client * client)
+{
+    hx170dec_client *next, *tmp;
+
+    spin_lock(&dev->res_lock);
+    if(!client->reserved)
+    {
+        spin_unlock(&dev->res_lock);
+        return;
+    }
+    client->reserved = 0;
+
+    if(--dev->res_count == 0)
+    {
+        dev->res_owner = 0;
+        if(!list_empty(&dev->res_waiters))
+        {
+            next = list_entry(dev->res_waiters.next, hx170dec_client,
+                              res_list);
+            dev->res_owner = next->pid;
+            /* grant all waiting clients of the new owner */
+            list_for_each_entry_safe(next, tmp, &dev->res_waiters, res_list)
+            {
+                if(next->pid != dev->res_owner)
+                    continue;
+                list_del(&next->res_list);
+                next->granted = 1;
+                dev->res_count++;
+            }
+            wake_up_interruptible_all(&dev->res_queue);
+        }
+    }
+    spin_unlock(&dev->res_lock);
+}
+
+/*------------------------------------------------------------------------------
+    Function name   : WaitIrq
+    Description     : Wait for the next IRQ of the client's unit (dec or pp)
+
+    Return type     : int
+------------------------------------------------------------------------------*/
+
+static int WaitIrq(hx170dec_t * dev, hx170dec_client * client,
+                   unsigned long timeout_ms)
+{
+    unsigned int *irqs = client->pp ? &dev->pp_irqs : &dev->dec_irqs;
+    wait_queue_head_t *queue = client->pp ? &dev->pp_queue : &dev->dec_queue;
+    long timeout = MAX_SCHEDULE_TIMEOUT;
+    unsigned long flags;
+    long ret;
+
+    if(timeout_ms)
+        timeout = msecs_to_jiffies(timeout_ms);
+
+    /* the frame is running now, start its clock */
+    spin_lock_irqsave(&dev->lock, flags);
+    if(*irqs == client->seen)
+    {
+        if(client->pp)
+        {
+            dev->pp_start = ktime_get();
+            dev->pp_timing = 1;
+        }
+        else
+        {
+            dev->dec_start = ktime_get();
+            dev->dec_timing = 1;
+        }
+    }
+    spin_unlock_irqrestore(&dev->lock, flags);
+
+    ret = wait_event_interruptible_timeout(*queue, *irqs != client->seen,
+                                           timeout);
+    if(ret < 0)
+        return ret;
+    if(ret == 0)
+        return -ETIMEDOUT;
+
+    client->seen = *irqs;
+    return 0;
+}
+
+static void UpdateTiming(Hx170Timing * t, ktime_t start, int timed)
+{
+    unsigned int us;
+
+    t->frames++;
+    if(!timed)
+        return;
+
+    us = (unsigned int) ktime_us_delta(ktime_get(), start);
+    t->timed++;
+    t->lastUs = us;
+    t->totalUs += us;
+    if(t->timed == 1 || us < t->minUs)
+        t->minUs = us;
+    if(us > t->maxUs)
+        t->maxUs = us;
+}
+
 static int hx170dec_ioctl(struct inode *inode, struct file *filp,
                           unsigned int cmd, unsigned long arg)
 {
     int err = 0;
-
-#ifdef HW_PERFORMANCE
-    struct timeval *end_time_arg;
-#endif
+    hx170dec_client *client = filp->private_data;
 
     PDEBUG("ioctl cmd 0x%08ux\n", cmd);
     /*
@@ -193,16 +382,45 @@ static int hx170dec_ioctl(struct inode *inode, struct file *filp,
         __put_user(hx170dec_data.iosize, (unsigned int *) arg);
         break;
     case HX170DEC_PP_INSTANCE:
-        filp->private_data = &hx_pp_instance;
+        client->pp = 1;
+        client->seen = hx170dec_data.pp_irqs;
         break;
 
-#ifdef HW_PERFORMANCE
     case HX170DEC_HW_PERFORMANCE:
-        end_time_arg = (struct timeval *) arg;
-        end_time_arg->tv_sec = end_time.tv_sec;
-        end_time_arg->tv_usec = end_time.tv_usec;
+        if(copy_to_user((void *) arg, &end_time, sizeof(end_time)))
+            return -EFAULT;
         break;
-#endif
+
+    case HX170DEC_IOCT_WAIT:
+        return WaitIrq(&hx170dec_data, client, arg);
+
+    case HX170DEC_IOC_RESERVE:
+        err = ReserveHw(&hx170dec_data, client);
+        if(err == 0)
+        {
+            /* IRQs before this point belong to somebody else */
+            client->seen = client->pp ? hx170dec_data.pp_irqs :
+                hx170dec_data.dec_irqs;
+        }
+        return err;
+
+    case HX170DEC_IOC_RELEASE:
+        ReleaseHw(&hx170dec_data, client);
+        break;
+
+    case HX170DEC_IOCGSTATS:
+        {
+            Hx170Stats stats;
+            unsigned long flags;
+
+            spin_lock_irqsave(&hx170dec_data.lock, flags);
+            stats = hx170dec_data.stats;
+            spin_unlock_irqrestore(&hx170dec_data.lock, flags);
+
+            if(copy_to_user((void *) arg, &stats, sizeof(stats)))
+                return -EFAULT;
+            break;
+        }
     }
     return 0;
 }
@@ -216,12 +434,49 @@ static int hx170dec_ioctl(struct inode *inode, struct file *filp,
 
 static int hx170dec_open(struct inode *inode, struct file *filp)
 {
-    filp->private_data = &hx_dec_instance;
+    hx170dec_client *client;
+
+    client = kzalloc(sizeof(*client), GFP_KERNEL);
+    if(client == NULL)
+        return -ENOMEM;
+
+    INIT_LIST_HEAD(&client->res_list);
+    client->pid = current->tgid;
+    client->seen = hx170dec_data.dec_irqs;
+    filp->private_data = client;
 
     PDEBUG("dev opened\n");
     return 0;
 }
 
+/*------------------------------------------------------------------------------
+    Function name   : hx170dec_poll
+    Description     : readable when an IRQ of the client's unit arrived after
+                      its last HX170DEC_IOCT_WAIT
+
+    Return type     : unsigned int
+------------------------------------------------------------------------------*/
+
+static unsigned int hx170dec_poll(struct file *filp, poll_table * wait)
+{
+    hx170dec_t *dev = &hx170dec_data;
+    hx170dec_client *client = filp->private_data;
+    unsigned int irqs;
+
+    if(client->pp)
+    {
+        poll_wait(filp, &dev->pp_queue, wait);
+        irqs = dev->pp_irqs;
+    }
+    else
+    {
+        poll_wait(filp, &dev->dec_queue, wait);
+        irqs = dev->dec_irqs;
+    }
+
+    return irqs != client->seen ? POLLIN | POLLRDNORM : 0;
+}
+
 /*------------------------------------------------------------------------------
     Function name   : hx170dec_fasync
     Description     : Method for signing up for a interrupt
@@ -237,7 +492,7 @@ static int hx170dec_fasync(int fd, struct file *filp, int mode)
 
     /* select which interrupt this instance will sign up for */
 
-    if(((u32 *) filp->private_data) == &hx_dec_instance)
+    if(!((hx170dec_client *) filp->private_data)->pp)
     {
         /* decoder */
         PDEBUG("decoder fasync called %d %x %d %x\n",
@@ -266,7 +521,7 @@ static int hx170dec_fasync(int fd, struct file *filp, int mode)
 static int hx170dec_release(struct inode *inode, struct file *filp)
 {
 
-    /* hx170dec_t *dev = &hx170dec_data; */
+    hx170dec_t *dev = &hx170dec_data;
 
     if(filp->f_flags & FASYNC)
     {
@@ -274,6 +529,10 @@ static int hx170dec_release(struct inode *inode, struct file *filp)
         hx170dec_fasync(-1, filp, 0);
     }
 
+    /* don't leave the hardware locked when a client dies */
+    ReleaseHw(dev, filp->private_data);
+    kfree(filp->private_data);
+
     PDEBUG("dev closed\n");
     return 0;
 }
@@ -283,6 +542,7 @@ static struct file_operations hx170dec_fops = {
   open:hx170dec_open,
   release:hx170dec_release,
   ioctl:hx170dec_ioctl,
+  poll:hx170dec_poll,
   fasync:hx170dec_fasync,
 };
 
@@ -310,6 +570,13 @@ int __init hx170dec_init(void)
     hx170dec_data.async_queue_dec = NULL;
     hx170dec_data.async_queue_pp = NULL;
 
+    spin_lock_init(&hx170dec_data.lock);
+    init_waitqueue_head(&hx170dec_data.dec_queue);
+    init_waitqueue_head(&hx170dec_data.pp_queue);
+    spin_lock_init(&hx170dec_data.res_lock);
+    INIT_LIST_HEAD(&hx170dec_data.res_waiters);
+    init_waitqueue_head(&hx170dec_data.res_queue);
+
     result = register_chrdev(hx170dec_major, "hx170dec", &hx170dec_fops);
     if(result < 0)
     {
@@ -518,12 +785,18 @@ irqreturn_t hx170dec_isr(int irq, void *dev_id)
 
         if(irq_status_dec & HX_DEC_INTERRUPT_BIT)
         {
-#ifdef HW_PERFORMANCE
             do_gettimeofday(&end_time);
-#endif
             /* clear dec IRQ */
             writel(irq_status_dec & (~HX_DEC_INTERRUPT_BIT),
                    dev->hwregs + X170_INTERRUPT_REGISTER_DEC);
+
+            spin_lock(&dev->lock);
+            UpdateTiming(&dev->stats.dec, dev->dec_start, dev->dec_timing);
+            dev->dec_timing = 0;
+            dev->dec_irqs++;
+            spin_unlock(&dev->lock);
+            wake_up_interruptible(&dev->dec_queue);
+
             /* fasync kill for decoder instances */
             if(dev->async_queue_dec != NULL)
             {
@@ -541,13 +814,18 @@ irqreturn_t hx170dec_isr(int irq, void *dev_id)
 
         if(irq_status_pp & HX_PP_INTERRUPT_BIT)
         {
-#ifdef HW_PERFORMANCE
             do_gettimeofday(&end_time);
-#endif
             /* clear pp IRQ */
             writel(irq_status_pp & (~HX_PP_INTERRUPT_BIT),
                    dev->hwregs + X170_INTERRUPT_REGISTER_PP);
 
+            spin_lock(&dev->lock);
+            UpdateTiming(&dev->stats.pp, dev->pp_start, dev->pp_timing);
+            dev->pp_timing = 0;
+            dev->pp_irqs++;
+            spin_unlock(&dev->lock);
+            wake_up_interruptible(&dev->pp_queue);
+
             /* kill fasync for PP instances */
             if(dev->async_queue_pp != NULL)
             {
@@ -70,6 +70,32 @@
 #define HX170DEC_IOC_CLI           _IO(HX170DEC_IOC_MAGIC,  5)
 #define HX170DEC_IOC_STI           _IO(HX170DEC_IOC_MAGIC,  6)
 
-#define HX170DEC_IOC_MAXNR 6
+/* wait for the next dec (or pp) IRQ, arg = timeout in ms, 0 = forever */
+#define HX170DEC_IOCT_WAIT         _IO(HX170DEC_IOC_MAGIC,  7)
+/* get exclusive use of the hardware, queued in FIFO order */
+#define HX170DEC_IOC_RESERVE       _IO(HX170DEC_IOC_MAGIC,  8)
+#define HX170DEC_IOC_RELEASE       _IO(HX170DEC_IOC_MAGIC,  9)
+#define HX170DEC_IOCGSTATS         _IOR(HX170DEC_IOC_MAGIC, 10, Hx170Stats)
+
+#define HX170DEC_IOC_MAXNR 10
+
+/*
+ * Hardware timing. A frame is timed from the HX170DEC_IOCT_WAIT call that
+ * waits for it until its IRQ, so only frames that somebody waited for
+ * are timed.
+ */
+typedef struct {
+    unsigned int frames;        /* IRQs received */
+    unsigned int timed;         /* frames with a timing sample */
+    unsigned int lastUs;
+    unsigned int minUs;
+    unsigned int maxUs;
+    unsigned long long totalUs;
+}Hx170Timing;
+
+typedef struct {
+    Hx170Timing dec;
+    Hx170Timing pp;
+}Hx170Stats;
 
 #endif /* !_HX170DEC_H_ */
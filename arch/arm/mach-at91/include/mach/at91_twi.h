@@ -57,6 +57,10 @@
 #define		AT91_TWI_ARBLST		(1 <<  9)	/* Arbitration Lost [SAM9260 only] */
 #define		AT91_TWI_SCLWS		(1 << 10)	/* Clock Wait State [SAM9260 only] */
 #define		AT91_TWI_EOSACC		(1 << 11)	/* End of Slave Address [SAM9260 only] */
+#define		AT91_TWI_ENDRX		(1 << 12)	/* End of Receive Buffer [SAM9RL, SAM9G45 only] */
+#define		AT91_TWI_ENDTX		(1 << 13)	/* End of Transmit Buffer [SAM9RL, SAM9G45 only] */
+#define		AT91_TWI_RXBUFF		(1 << 14)	/* Receive Buffer Full [SAM9RL, SAM9G45 only] */
+#define		AT91_TWI_TXBUFE		(1 << 15)	/* Transmit Buffer Empty [SAM9RL, SAM9G45 only] */
 
 #define	AT91_TWI_IER		0x24		/* Interrupt Enable Register */
 #define	AT91_TWI_IDR		0x28		/* Interrupt Disable Register */
@@ -34,6 +34,7 @@
 #include <linux/mtd/partitions.h>
 #include <linux/device.h>
 #include <linux/i2c.h>
+#include <linux/serial.h>
 #include <linux/leds.h>
 #include <linux/delay.h>
 #include <linux/spi/spi.h>
@@ -47,22 +48,9 @@
 #define AML 'L'
 #define AM3 '3'
 
-static inline unsigned long at91_platform_type(void)
-{	
-	at91_set_gpio_input(AT91_PIN_PC30,1);	
-	at91_set_gpio_input(AT91_PIN_PC31,1);
-	
-	udelay(1000);
-	if (at91_get_gpio_value(AT91_PIN_PC31))
-	{
-		if (at91_get_gpio_value(AT91_PIN_PC30))
-			return AM3;	// AM300
-		else
-			return AML;	// Access Manager LEGIC
-	} 
-	else
-		return AMM;		// Access Manager MIFARE
-}
+extern void __init at91_detect_platform_type(void);
+extern unsigned long at91_platform_type(void);
+extern const char *at91_platform_name(void);
 
  /* USB Device */
 struct at91_udc_data {
@@ -151,6 +139,7 @@ extern void __init at91_add_device_spi(struct spi_board_info *devices, int nr_de
 
 extern void __init at91_register_uart(unsigned id, unsigned portnr, unsigned pins);
 extern void __init at91_set_serial_console(unsigned portnr);
+extern void __init at91_set_uart_rs485(unsigned portnr, const struct serial_rs485 *rs485);
 
 struct at91_uart_config {
 	unsigned short	console_tty;	/* tty number of serial console */
@@ -164,6 +153,7 @@ struct atmel_uart_data {
 	short		use_dma_tx;	/* use transmit DMA? */
 	short		use_dma_rx;	/* use receive DMA? */
 	void __iomem	*regs;		/* virtual base address, if any */
+	struct serial_rs485 rs485;	/* RS485 settings at startup */
 };
 extern void __init at91_add_device_serial(void);
 
@@ -39,6 +39,8 @@
 #include <linux/mm.h>
 /* obviously, for kmalloc */
 #include <linux/slab.h>
+/* page bookkeeping of the linear region */
+#include <linux/vmalloc.h>
 /* for struct file_operations, register_chrdev() */
 #include <linux/fs.h>
 /* standard error codes */
@@ -50,8 +52,11 @@
 #include <asm/uaccess.h>
 #include <linux/ioport.h>
 #include <linux/list.h>
+#include <linux/mutex.h>
 /* for current pid */
 #include <linux/sched.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 /* Our header */
 #include "memalloc.h"
@@ -67,119 +72,68 @@ MODULE_DESCRIPTION("RAM allocation");
 #define HLINA_START_ADDRESS 0x02000000
 #endif
 
-#define MAX_OPEN 32
-#define ID_UNUSED 0xFF
-#define MEMALLOC_BASIC 0
-#define MEMALLOC_MAX_OUTPUT 1
-#define MEMALLOC_BASIC_X2 2
-
-/* selects the memory allocation method, i.e. which allocation scheme table is used */
-unsigned int alloc_method = MEMALLOC_BASIC;
+#define HLINA_SIZE          (64 * 1024 * 1024)
+
+/*
+ * The linear region is managed by a binary buddy allocator with 4 kB
+ * pages. Free blocks of 2^order pages are kept on one list per order.
+ * A request is served from the smallest block that is large enough and
+ * the unused tail of that block is given back right away, so a buffer
+ * occupies only the pages it needs. Freed pages are merged with their
+ * buddies again.
+ */
+#define HLINA_PAGE_SHIFT    12
+#define HLINA_PAGE_SIZE     (1 << HLINA_PAGE_SHIFT)
+#define HLINA_PAGES         (HLINA_SIZE >> HLINA_PAGE_SHIFT)
+#define HLINA_ORDERS        15  /* 4 kB ... 64 MB blocks */
 
 static int memalloc_major = 0;  /* dynamic */
 
-int id[MAX_OPEN] = { ID_UNUSED };
-
-/* module_param(name, type, perm) */
-module_param(alloc_method, uint, 0);
+/* one per open file handle */
+struct memalloc_client
+{
+    struct list_head list;      /* on client_list */
+    struct list_head allocs;    /* buffers owned by this client */
+    pid_t pid;
+    unsigned int pages;         /* pages currently allocated */
+    unsigned int peak;          /* high-water mark in pages */
+};
 
 /* here's all the must remember stuff */
 struct allocation
 {
     struct list_head list;
-    void *buffer;
-    unsigned int order;
-    int fid;
+    unsigned int first;         /* first page of the buffer */
+    unsigned int pages;
+    struct memalloc_client *client;
 };
 
-struct list_head heap_list;
-
-static spinlock_t mem_lock = SPIN_LOCK_UNLOCKED;
-
-typedef struct hlinc
+/* one per page of the linear region */
+typedef struct hlinp
 {
-    unsigned int bus_address;
-    unsigned int used;
-    unsigned int size;
-    int file_id;
-} hlina_chunk;
-
-static unsigned int *size_table = NULL;
-static size_t chunks = 0;
-
-unsigned int size_table_0[] = {
-    1, 1, 1, 1, 1, 1, 1, 1, 1,
-    4, 4, 4, 4, 4, 4, 4, 4,
-    10, 10, 10, 10,
-    22, 22, 22, 22,
-    38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38,
-    50, 50, 50, 50, 50, 50, 50,
-    75, 75, 75, 75, 75,
-    86, 86, 86, 86, 86,
-    113, 113,
-    152, 152,
-    162, 162, 162,
-    270, 270, 270,
-    403, 403, 403, 403,
-    403, 403,
-    450, 450,
-    893, 893,
-    893, 893,
-    1999,
-    3997,
-    4096,
-    8192
-};
+    struct list_head list;      /* free list link, head of a free block */
+    struct allocation *alloc;   /* head of an allocated buffer */
+    unsigned char order;        /* order of the free block */
+    unsigned char free;         /* head of a free block */
+} hlina_page;
 
-unsigned int size_table_1[] = {
-    0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0,
-    0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0,
-    0, 0,
-    0, 0,
-    0, 0, 0,
-    0, 0, 0,
-    0, 0,
-    0, 64,
-    64, 128,
-    512,
-    3072,
-    8448
-};
+static hlina_page *hlina_pages = NULL;
+static struct list_head free_area[HLINA_ORDERS];
+static unsigned int free_blocks[HLINA_ORDERS];
 
-unsigned int size_table_2[] = {
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
-    10, 10, 10, 10, 10, 10, 10, 10,
-    22, 22, 22, 22, 22, 22, 22, 22,
-    38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 38, 
-    50, 50, 50, 50, 50, 50, 50, 50, 50, 50, 50, 50, 50, 50,
-    75, 75, 75, 75, 75, 75, 75, 75, 75, 75,
-    86, 86, 86, 86, 86, 86, 86, 86, 86, 86,
-    113, 113, 113, 113,
-    152, 152, 152, 152,
-    162, 162, 162, 162, 162, 162,
-    270, 270, 270, 270, 270, 270,
-    403, 403, 403, 403, 403, 403, 403, 403,
-    403, 403, 403, 403,
-    450, 450, 450, 450,
-    893, 893, 893, 893,
-    893, 893, 893, 893,
-    1999, 1999,
-    3997, 3997,
-    4096, 4096,
-    8192, 8192
-};
+static LIST_HEAD(client_list);
 
-static hlina_chunk hlina_chunks[256];
+static DEFINE_MUTEX(mem_lock);
 
-static int AllocMemory(unsigned *busaddr, unsigned int size, struct file *filp);
-static int FreeMemory(unsigned long busaddr);
+/* statistics, all in pages */
+static unsigned int used_pages = 0;
+static unsigned int peak_pages = 0;
+static unsigned int alloc_count = 0;
+static unsigned int alloc_failures = 0;
+
+static int AllocMemory(unsigned *busaddr, unsigned int size,
+                       struct memalloc_client *client);
+static int FreeMemory(unsigned long busaddr, struct memalloc_client *client);
 static void ResetMems(void);
 
 static int memalloc_ioctl(struct inode *inode, struct file *filp,
@@ -215,7 +169,9 @@ static int memalloc_ioctl(struct inode *inode, struct file *filp,
     case MEMALLOC_IOCHARDRESET:
 
         PDEBUG("HARDRESET\n");
+        mutex_lock(&mem_lock);
         ResetMems();
+        mutex_unlock(&mem_lock);
 
         break;
 
@@ -225,15 +181,18 @@ static int memalloc_ioctl(struct inode *inode, struct file *filp,
             MemallocParams memparams;
 
             PDEBUG("GETBUFFER\n");
-            spin_lock(&mem_lock);
-
-            __copy_from_user(&memparams, (const void *) arg, sizeof(memparams));
 
-            result = AllocMemory(&memparams.busAddress, memparams.size, filp);
+            if(__copy_from_user(&memparams, (const void *) arg,
+                                sizeof(memparams)))
+                return -EFAULT;
 
-            __copy_to_user((void *) arg, &memparams, sizeof(memparams));
+            mutex_lock(&mem_lock);
+            result = AllocMemory(&memparams.busAddress, memparams.size,
+                                 filp->private_data);
+            mutex_unlock(&mem_lock);
 
-            spin_unlock(&mem_lock);
+            if(__copy_to_user((void *) arg, &memparams, sizeof(memparams)))
+                return -EFAULT;
 
             return result;
         }
@@ -243,11 +202,13 @@ static int memalloc_ioctl(struct inode *inode, struct file *filp,
             unsigned long busaddr;
 
             PDEBUG("FREEBUFFER\n");
-            spin_lock(&mem_lock);
-            __get_user(busaddr, (unsigned long *) arg);
-            ret = FreeMemory(busaddr);
+            if(__get_user(busaddr, (unsigned long *) arg))
+                return -EFAULT;
+
+            mutex_lock(&mem_lock);
+            ret = FreeMemory(busaddr, filp->private_data);
+            mutex_unlock(&mem_lock);
 
-            spin_unlock(&mem_lock);
             return ret;
         }
     }
@@ -256,39 +217,44 @@ static int memalloc_ioctl(struct inode *inode, struct file *filp,
 
 static int memalloc_open(struct inode *inode, struct file *filp)
 {
-    int i = 0;
+    struct memalloc_client *client;
 
-    for(i = 0; i < MAX_OPEN + 1; i++)
-    {
+    client = kzalloc(sizeof(*client), GFP_KERNEL);
+    if(client == NULL)
+        return -ENOMEM;
 
-        if(i == MAX_OPEN)
-            return -1;
-        if(id[i] == ID_UNUSED)
-        {
-            id[i] = i;
-            filp->private_data = id + i;
-            break;
-        }
-    }
+    INIT_LIST_HEAD(&client->allocs);
+    client->pid = current->tgid;
+
+    mutex_lock(&mem_lock);
+    list_add_tail(&client->list, &client_list);
+    mutex_unlock(&mem_lock);
+
+    filp->private_data = client;
     PDEBUG("dev opened\n");
     return 0;
 
 }
 
+static void ReleaseAllocation(struct allocation *alloc);
+
 static int memalloc_release(struct inode *inode, struct file *filp)
 {
+    struct memalloc_client *client = filp->private_data;
+    struct allocation *alloc, *tmp;
 
-    int i = 0;
-
-    for(i = 0; i < chunks; i++)
+    /* free whatever the client left behind */
+    mutex_lock(&mem_lock);
+    list_for_each_entry_safe(alloc, tmp, &client->allocs, list)
     {
-        if(hlina_chunks[i].file_id == *((int *) (filp->private_data)))
-        {
-            hlina_chunks[i].used = 0;
-            hlina_chunks[i].file_id = ID_UNUSED;
-        }
+        PDEBUG("pid %d did not free 0x%08x\n", client->pid,
+               HLINA_START_ADDRESS + (alloc->first << HLINA_PAGE_SHIFT));
+        ReleaseAllocation(alloc);
     }
-    *((int *) filp->private_data) = ID_UNUSED;
+    list_del(&client->list);
+    mutex_unlock(&mem_lock);
+
+    kfree(client);
     PDEBUG("dev closed\n");
     return 0;
 }
@@ -300,34 +266,83 @@ static struct file_operations memalloc_fops = {
   ioctl:memalloc_ioctl,
 };
 
+#ifdef CONFIG_DEBUG_FS
+static struct dentry *memalloc_debugfs;
+
+static int memalloc_debugfs_show(struct seq_file *s, void *unused)
+{
+    struct memalloc_client *client;
+    unsigned int free_pages = 0;
+    int largest = -1;
+    int i;
+
+    mutex_lock(&mem_lock);
+
+    for(i = 0; i < HLINA_ORDERS; i++)
+    {
+        free_pages += free_blocks[i] << i;
+        if(free_blocks[i])
+            largest = i;
+    }
+
+    seq_printf(s, "region:      0x%08x, %u kB\n", HLINA_START_ADDRESS,
+               HLINA_SIZE / 1024);
+    seq_printf(s, "used:        %u kB\n", used_pages * (HLINA_PAGE_SIZE / 1024));
+    seq_printf(s, "peak:        %u kB\n", peak_pages * (HLINA_PAGE_SIZE / 1024));
+    seq_printf(s, "free:        %u kB\n", free_pages * (HLINA_PAGE_SIZE / 1024));
+    seq_printf(s, "largest:     %u kB\n",
+               largest < 0 ? 0 : (HLINA_PAGE_SIZE / 1024) << largest);
+    /* share of the free memory that is not in the largest free block */
+    seq_printf(s, "fragmented:  %u%%\n", free_pages == 0 ? 0 :
+               100 - ((largest < 0 ? 0 : 1 << largest) * 100) / free_pages);
+    seq_printf(s, "allocations: %u (%u failed)\n", alloc_count,
+               alloc_failures);
+
+    seq_printf(s, "\nfree blocks:\n");
+    for(i = 0; i < HLINA_ORDERS; i++)
+    {
+        if(free_blocks[i])
+            seq_printf(s, "  %6u kB: %u\n", (HLINA_PAGE_SIZE / 1024) << i,
+                       free_blocks[i]);
+    }
+
+    seq_printf(s, "\nclients:\n");
+    list_for_each_entry(client, &client_list, list)
+    {
+        seq_printf(s, "  pid %5d: %u kB, peak %u kB\n", client->pid,
+                   client->pages * (HLINA_PAGE_SIZE / 1024),
+                   client->peak * (HLINA_PAGE_SIZE / 1024));
+    }
+
+    mutex_unlock(&mem_lock);
+    return 0;
+}
+
+static int memalloc_debugfs_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, memalloc_debugfs_show, inode->i_private);
+}
+
+static const struct file_operations memalloc_debugfs_fops = {
+  owner:THIS_MODULE,
+  open:memalloc_debugfs_open,
+  read:seq_read,
+  llseek:seq_lseek,
+  release:single_release,
+};
+#endif
+
 int __init memalloc_init(void)
 {
     int result;
-    int i = 0;
 
     PDEBUG("module init\n");
     printk("memalloc: 8190 Linear Memory Allocator, %s \n", "$Revision: 1.1 $");
     printk("memalloc: linear memory base = 0x%08x \n", HLINA_START_ADDRESS);
 
-    switch (alloc_method)
-    {
-
-    case MEMALLOC_MAX_OUTPUT:
-        size_table = size_table_1;
-        chunks = (sizeof(size_table_1) / sizeof(*size_table_1));
-        printk(KERN_INFO "memalloc: allocation method: MEMALLOC_MAX_OUTPUT\n");
-        break;
-    case MEMALLOC_BASIC_X2:
-        size_table = size_table_2;
-        chunks = (sizeof(size_table_2) / sizeof(*size_table_2));
-        printk(KERN_INFO "memalloc: allocation method: MEMALLOC_BASIC x 2\n");
-        break;
-    default:
-        size_table = size_table_0;
-        chunks = (sizeof(size_table_0) / sizeof(*size_table_0));
-        printk(KERN_INFO "memalloc: allocation method: MEMALLOC_BASIC\n");
-        break;
-    }
+    hlina_pages = vmalloc(HLINA_PAGES * sizeof(*hlina_pages));
+    if(hlina_pages == NULL)
+        return -ENOMEM;
 
     result = register_chrdev(memalloc_major, "memalloc", &memalloc_fops);
     if(result < 0)
@@ -342,17 +357,16 @@ int __init memalloc_init(void)
 
     ResetMems();
 
-    /* We keep a register of out customers, reset it */
-    for(i = 0; i < MAX_OPEN; i++)
-    {
-        id[i] = ID_UNUSED;
-    }
+#ifdef CONFIG_DEBUG_FS
+    memalloc_debugfs = debugfs_create_file("memalloc", S_IRUGO, NULL, NULL,
+                                           &memalloc_debugfs_fops);
+#endif
 
     return 0;
 
   err:
     PDEBUG("memalloc: module not inserted\n");
-    unregister_chrdev(memalloc_major, "memalloc");
+    vfree(hlina_pages);
     return result;
 }
 
@@ -361,7 +375,11 @@ void __exit memalloc_cleanup(void)
 
     PDEBUG("clenup called\n");
 
+#ifdef CONFIG_DEBUG_FS
+    debugfs_remove(memalloc_debugfs);
+#endif
     unregister_chrdev(memalloc_major, "memalloc");
+    vfree(hlina_pages);
 
     PDEBUG("memalloc: module removed\n");
     return;
@@ -370,80 +388,200 @@ void __exit memalloc_cleanup(void)
 module_init(memalloc_init);
 module_exit(memalloc_cleanup);
 
-/* Cycle through the buffers we have, give the first free one */
-static int AllocMemory(unsigned *busaddr, unsigned int size, struct file *filp)
+/* Put a block on its free list, merging it with its buddies */
+static void FreeBlock(unsigned int first, unsigned int order)
 {
+    while(order < HLINA_ORDERS - 1)
+    {
+        unsigned int buddy = first ^ (1 << order);
 
-    int i = 0;
+        if(buddy >= HLINA_PAGES || !hlina_pages[buddy].free ||
+           hlina_pages[buddy].order != order)
+            break;
 
-    *busaddr = 0;
+        list_del(&hlina_pages[buddy].list);
+        hlina_pages[buddy].free = 0;
+        free_blocks[order]--;
+
+        first &= buddy;
+        order++;
+    }
+
+    hlina_pages[first].free = 1;
+    hlina_pages[first].order = order;
+    list_add(&hlina_pages[first].list, &free_area[order]);
+    free_blocks[order]++;
+}
 
-    for(i = 0; i < chunks; i++)
+/* Free a range of pages as the largest aligned blocks that fit */
+static void FreeRange(unsigned int first, unsigned int pages)
+{
+    while(pages)
     {
+        unsigned int order = 0;
 
-        if(!hlina_chunks[i].used && (hlina_chunks[i].size >= size))
-        {
-            *busaddr = hlina_chunks[i].bus_address;
-            hlina_chunks[i].used = 1;
-            hlina_chunks[i].file_id = *((int *) (filp->private_data));
+        while(order < HLINA_ORDERS - 1 && !(first & (1 << order)) &&
+              (2 << order) <= pages)
+            order++;
+
+        FreeBlock(first, order);
+        first += 1 << order;
+        pages -= 1 << order;
+    }
+}
+
+/* Take @pages contiguous pages, returns the first page or -1 */
+static int AllocPages(unsigned int pages)
+{
+    unsigned int order = 0;
+    unsigned int o;
+    unsigned int first;
+    hlina_page *p;
+
+    while((1 << order) < pages)
+        order++;
+    if(order >= HLINA_ORDERS)
+        return -1;
+
+    for(o = order; o < HLINA_ORDERS; o++)
+    {
+        if(!list_empty(&free_area[o]))
             break;
-        }
     }
+    if(o == HLINA_ORDERS)
+        return -1;
+
+    p = list_entry(free_area[o].next, hlina_page, list);
+    list_del(&p->list);
+    p->free = 0;
+    free_blocks[o]--;
+    first = p - hlina_pages;
 
-    if(*busaddr == 0)
+    /* split, the upper halves cannot merge with anything */
+    while(o > order)
     {
-        printk("memalloc: Allocation FAILED: size = %d\n", size);
+        o--;
+        p = &hlina_pages[first + (1 << o)];
+        p->free = 1;
+        p->order = o;
+        list_add(&p->list, &free_area[o]);
+        free_blocks[o]++;
     }
-    else
+
+    /* give back what we don't need */
+    FreeRange(first + pages, (1 << order) - pages);
+
+    return first;
+}
+
+static int AllocMemory(unsigned *busaddr, unsigned int size,
+                       struct memalloc_client *client)
+{
+    struct allocation *alloc;
+    unsigned int pages;
+    int first;
+
+    *busaddr = 0;
+
+    pages = (size + HLINA_PAGE_SIZE - 1) >> HLINA_PAGE_SHIFT;
+    if(pages == 0 || pages > HLINA_PAGES)
+        return -EINVAL;
+
+    alloc = kmalloc(sizeof(*alloc), GFP_KERNEL);
+    if(alloc == NULL)
+        return -ENOMEM;
+
+    first = AllocPages(pages);
+    if(first < 0)
     {
-        PDEBUG("MEMALLOC OK: size: %d, size reserved: %d\n", size,
-               hlina_chunks[i].size);
+        kfree(alloc);
+        alloc_failures++;
+        printk("memalloc: Allocation FAILED: size = %d\n", size);
+        return -ENOMEM;
     }
 
+    alloc->first = first;
+    alloc->pages = pages;
+    alloc->client = client;
+    list_add(&alloc->list, &client->allocs);
+    hlina_pages[first].alloc = alloc;
+
+    client->pages += pages;
+    if(client->pages > client->peak)
+        client->peak = client->pages;
+    used_pages += pages;
+    if(used_pages > peak_pages)
+        peak_pages = used_pages;
+    alloc_count++;
+
+    *busaddr = HLINA_START_ADDRESS + (first << HLINA_PAGE_SHIFT);
+
+    PDEBUG("MEMALLOC OK: size: %d, size reserved: %d\n", size,
+           pages << HLINA_PAGE_SHIFT);
+
     return 0;
 }
 
+static void ReleaseAllocation(struct allocation *alloc)
+{
+    hlina_pages[alloc->first].alloc = NULL;
+    FreeRange(alloc->first, alloc->pages);
+
+    alloc->client->pages -= alloc->pages;
+    used_pages -= alloc->pages;
+
+    list_del(&alloc->list);
+    kfree(alloc);
+}
+
 /* Free a buffer based on bus address */
-static int FreeMemory(unsigned long busaddr)
+static int FreeMemory(unsigned long busaddr, struct memalloc_client *client)
 {
-    int i = 0;
+    struct allocation *alloc;
+    unsigned int first;
 
-    for(i = 0; i < chunks; i++)
-    {
-        if(hlina_chunks[i].bus_address == busaddr)
-        {
-            hlina_chunks[i].used = 0;
-            hlina_chunks[i].file_id = ID_UNUSED;
-        }
-    }
+    if(busaddr < HLINA_START_ADDRESS ||
+       busaddr >= HLINA_START_ADDRESS + HLINA_SIZE ||
+       (busaddr & (HLINA_PAGE_SIZE - 1)))
+        return -EINVAL;
+
+    first = (busaddr - HLINA_START_ADDRESS) >> HLINA_PAGE_SHIFT;
+    alloc = hlina_pages[first].alloc;
+    if(alloc == NULL || alloc->client != client)
+        return -EINVAL;
+
+    ReleaseAllocation(alloc);
 
     return 0;
 }
 
-/* Reset "used" status */
+/* Free all buffers of all clients and rebuild the free lists */
 void ResetMems(void)
 {
-    int i = 0;
-    unsigned int ba = HLINA_START_ADDRESS;
+    struct memalloc_client *client;
+    struct allocation *alloc, *tmp;
+    int i;
 
-    for(i = 0; i < chunks; i++)
+    list_for_each_entry(client, &client_list, list)
     {
-
-        hlina_chunks[i].bus_address = ba;
-        hlina_chunks[i].used = 0;
-        hlina_chunks[i].file_id = ID_UNUSED;
-        hlina_chunks[i].size = 4096 * size_table[i];
-
-        ba += hlina_chunks[i].size;
+        list_for_each_entry_safe(alloc, tmp, &client->allocs, list)
+        {
+            list_del(&alloc->list);
+            kfree(alloc);
+        }
+        client->pages = 0;
     }
 
-    printk("memalloc: %d bytes (%dMB) configured. Check RAM size!\n",
-           ba - (unsigned int)(HLINA_START_ADDRESS),
-          (ba - (unsigned int)(HLINA_START_ADDRESS)) / (1024 * 1024));
-
-    if(ba - (unsigned int)(HLINA_START_ADDRESS) > 96 * 1024 * 1024)
+    memset(hlina_pages, 0, HLINA_PAGES * sizeof(*hlina_pages));
+    for(i = 0; i < HLINA_ORDERS; i++)
     {
-        PDEBUG("MEMALLOC ERROR: MEMORY ALLOC BUG\n");
+        INIT_LIST_HEAD(&free_area[i]);
+        free_blocks[i] = 0;
     }
+    used_pages = 0;
+
+    FreeRange(0, HLINA_PAGES);
 
+    printk("memalloc: %d bytes (%dMB) configured. Check RAM size!\n",
+           HLINA_SIZE, HLINA_SIZE / (1024 * 1024));
 }
@@ -21,9 +21,16 @@
 #include <linux/delay.h>
 #include <linux/fs.h>
 #include <linux/types.h>
+#include <linux/interrupt.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/hrtimer.h>
+#include <linux/sched.h>
 #include <asm/uaccess.h>
 #include <asm/io.h>
 #include <asm/system.h>
+#include <mach/board.h>
+#include <mach/gpio.h>
 #include "amx.h"
 
 MODULE_AUTHOR("stefan.wyss@kaba.com");
@@ -50,6 +57,9 @@ MODULE_LICENSE("GPL");
 #define LG_NRES					(1<<30)
 #define SC_NRES					(1<<31)
 #define LG_TXRDY				(1<<13)
+#define LG_TXRDY_GPIO		AT91_PIN_PC13
+
+#define AMX_BUSYWAIT_MAX	5000			// delays up to this are busy-waited [us]
 
 #define AT91_BASE_PMC			0xfffffc00
 #define PMC_SCER				0x00
@@ -60,6 +70,13 @@ MODULE_LICENSE("GPL");
 static void * piocBase;
 static void * pmcBase;
 static unsigned char board=0;
+static u32 nresPin;										// LG_NRES or SC_NRES, 0 if none
+
+/*-----------------------------------------------------------------------------
+ * TX_READY interrupt state (AM-L only)
+ *---------------------------------------------------------------------------*/
+static int txrdyIrq = -1;
+static DECLARE_WAIT_QUEUE_HEAD(txrdyWait);
 
 /*-----------------------------------------------------------------------------
  * forward function declaration
@@ -67,6 +84,8 @@ static unsigned char board=0;
 void amx_exit(void);
 int amx_init(void);
 int amx_ioctl(struct inode*, struct file* , unsigned int, unsigned long);
+ssize_t amx_read(struct file*, char __user*, size_t, loff_t*);
+unsigned int amx_poll(struct file*, poll_table*);
 module_init(amx_init);
 module_exit(amx_exit);
 
@@ -76,65 +95,210 @@ module_exit(amx_exit);
 struct file_operations amx_fops = {
 	owner:	THIS_MODULE,
 	ioctl:	amx_ioctl,
+	read:		amx_read,
+	poll:		amx_poll,
 };
 
+/*-----------------------------------------------------------------------------
+ * amx_txrdy()
+ *
+ * Current level of LEGIC TX_READY.
+ *---------------------------------------------------------------------------*/
+static int amx_txrdy(void)
+{
+	return (readl(piocBase+PIO_PDSR)&LG_TXRDY)>0;
+}
+
+/*-----------------------------------------------------------------------------
+ * amx_txrdy_irq()
+ *
+ * PIOC change interrupt on TX_READY: wake up all waiters, they recheck the
+ * level themselves.
+ *---------------------------------------------------------------------------*/
+static irqreturn_t amx_txrdy_irq(int irq, void *dev_id)
+{
+	wake_up_interruptible(&txrdyWait);
+	return IRQ_HANDLED;
+}
+
+/*-----------------------------------------------------------------------------
+ * amx_wait_txrdy()
+ *
+ * Sleep until TX_READY is high or the timeout [ms] expires.
+ *---------------------------------------------------------------------------*/
+static int amx_wait_txrdy(unsigned long timeout)
+{
+	long ret;
+
+	if (txrdyIrq < 0)
+		return -ENODEV;
+
+	ret = wait_event_interruptible_timeout(txrdyWait, amx_txrdy(),
+		msecs_to_jiffies(timeout));
+	if (ret < 0)
+		return ret;
+	if (ret == 0 && !amx_txrdy())
+		return -ETIMEDOUT;
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * amx_delay_us()
+ *
+ * Short delays are busy-waited so they do not depend on HZ; longer ones sleep
+ * on an hrtimer.
+ *---------------------------------------------------------------------------*/
+static void amx_delay_us(unsigned int us)
+{
+	ktime_t kt;
+
+	if (us <= AMX_BUSYWAIT_MAX)
+	{
+		while (us >= 1000)
+		{
+			udelay(1000);
+			us -= 1000;
+		}
+		if (us)
+			udelay(us);
+		return;
+	}
+
+	kt = ktime_set(us / USEC_PER_SEC, (us % USEC_PER_SEC) * NSEC_PER_USEC);
+	set_current_state(TASK_UNINTERRUPTIBLE);
+	schedule_hrtimeout(&kt, HRTIMER_MODE_REL);
+}
+
+/*-----------------------------------------------------------------------------
+ * amx_reset_pulse()
+ *
+ * IOCTL_AMX_RESET_PULSE: pull the chip reset low, release it, let the chip
+ * settle and optionally wait until it reports TX_READY.
+ *---------------------------------------------------------------------------*/
+static int amx_reset_pulse(PULSEMSG *pulse)
+{
+	if (pulse->low > AMX_PULSE_MAX || pulse->settle > AMX_PULSE_MAX)
+		return -EINVAL;
+	if (pulse->timeout && txrdyIrq < 0)
+		return -ENODEV;
+
+	writel(nresPin, piocBase+PIO_CODR);
+	amx_delay_us(pulse->low);
+	writel(nresPin, piocBase+PIO_SODR);
+	amx_delay_us(pulse->settle);
+
+	if (pulse->timeout)
+		return amx_wait_txrdy(pulse->timeout);
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * amx_read()
+ *
+ * Block until TX_READY is high and return a DRVMSG snapshot of the pins.
+ *---------------------------------------------------------------------------*/
+ssize_t amx_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+	DRVMSG drvMsg;
+	u32 regval;
+
+	if (count < sizeof(drvMsg))
+		return -EINVAL;
+	if (txrdyIrq < 0)
+		return -ENODEV;
+
+	if (!amx_txrdy())
+	{
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(txrdyWait, amx_txrdy()))
+			return -ERESTARTSYS;
+	}
+
+	regval = readl(piocBase+PIO_PDSR);
+	drvMsg.nres = ((regval&nresPin)>0);
+	drvMsg.txrdy = ((regval&LG_TXRDY)>0);
+	drvMsg.board = board;
+	if (copy_to_user(buf, &drvMsg, sizeof(drvMsg)))
+		return -EFAULT;
+
+	return sizeof(drvMsg);
+}
+
+/*-----------------------------------------------------------------------------
+ * amx_poll()
+ *
+ * Readable while TX_READY is high.
+ *---------------------------------------------------------------------------*/
+unsigned int amx_poll(struct file *file, poll_table *wait)
+{
+	if (txrdyIrq < 0)
+		return POLLERR;
+
+	poll_wait(file, &txrdyWait, wait);
+	if (amx_txrdy())
+		return POLLIN | POLLRDNORM;
+	return 0;
+}
+
 /*-----------------------------------------------------------------------------
  * amx_ioctl()
  *---------------------------------------------------------------------------*/
 int amx_ioctl(struct inode *inode, struct file *file, unsigned int cmd, unsigned long arg)
 {
 	DRVMSG drvMsg;
+	PULSEMSG pulseMsg;
+	u32 regval;
 	int ret;
 	
-	// set output port direction specifiers
-	writel(LG_NRES|LG_TXRDY, piocBase+PIO_PER);	// PIO enable
-	writel(LG_NRES, piocBase+PIO_OER);			// OUTPUT enable
-	writel(LG_TXRDY, piocBase+PIO_ODR);			// OUTPUT disable
-	writel(1<<ID_PIOC,pmcBase+PMC_SCER);		// enable PIOC clock
-	
+	if (nresPin == 0)
+		return -EFAULT;
+
 	switch (cmd)
 	{
 		
+		// **************** IOCTL_AMX_SET / IOCTL_AMX_SETGET ****************
+		case IOCTL_AMX_SET:
+		case IOCTL_AMX_SETGET:
+
+			// get structure from user space
+			ret = copy_from_user(&drvMsg,(DRVMSG*)arg, sizeof(drvMsg));
+			if(ret)	
+				return -EFAULT;
+
+			writel(nresPin,(drvMsg.nres)?piocBase+PIO_SODR:piocBase+PIO_CODR);
+			if (cmd == IOCTL_AMX_SET)
+				break;
+			// fall through
+
 		// **************** IOCTL_AMX_GET ****************
 		case IOCTL_AMX_GET:		
 			
-			switch (board)
-			{
-				case AML:
-					drvMsg.nres = ((readl(piocBase+PIO_PDSR)&LG_NRES)>0);
-					drvMsg.txrdy = ((readl(piocBase+PIO_PDSR)&LG_TXRDY)>0);
-					break;
-				case AMM:
-					drvMsg.nres = ((readl(piocBase+PIO_PDSR)&SC_NRES)>0);
-					break;
-				default:
-					return -EFAULT;
-			}
+			// one snapshot of all pins
+			regval = readl(piocBase+PIO_PDSR);
+			drvMsg.nres = ((regval&nresPin)>0);
+			drvMsg.txrdy = (board == AML) ? ((regval&LG_TXRDY)>0) : 0;
+			drvMsg.board = board;
+
 			ret=copy_to_user((void*)arg,&drvMsg, sizeof(drvMsg));
 			if (ret!=0)
 				return -EFAULT;
 			break;
-					
-		// **************** IOCTL_AMX_SET ****************
-		case IOCTL_AMX_SET:
 
-			// get structure from user space
-			ret = copy_from_user(&drvMsg,(DRVMSG*)arg, sizeof(drvMsg));
+		// **************** IOCTL_AMX_WAIT_TXRDY ****************
+		case IOCTL_AMX_WAIT_TXRDY:
+
+			return amx_wait_txrdy(arg);
+
+		// **************** IOCTL_AMX_RESET_PULSE ****************
+		case IOCTL_AMX_RESET_PULSE:
+
+			// get pulse parameters from user space
+			ret = copy_from_user(&pulseMsg,(PULSEMSG*)arg, sizeof(pulseMsg));
 			if(ret)	
 				return -EFAULT;
 
-			switch (board)
-			{
-				case AML:
-					writel(LG_NRES,(drvMsg.nres)?piocBase+PIO_SODR:piocBase+PIO_CODR);
-					break;
-				case AMM:
-					writel(SC_NRES,(drvMsg.nres)?piocBase+PIO_SODR:piocBase+PIO_CODR);
-					break;
-				default:
-					return -EFAULT;
-			}		
-			break;
+			return amx_reset_pulse(&pulseMsg);
 
 		default:
 			return -EFAULT;
@@ -161,34 +325,35 @@ int amx_init(void)
 		return res;
 	}
 
-	// set output port direction specifiers
-	writel(LG_NRES|LG_TXRDY, piocBase+PIO_PER);	// PIO enable
-	writel(LG_NRES, piocBase+PIO_OER);			// OUTPUT enable
-	writel(LG_TXRDY, piocBase+PIO_ODR);			// OUTPUT disable
+	// AMx board/system type as detected at boot
+	board = at91_platform_type();
+	if (board == AML)
+		nresPin = LG_NRES;
+	else if (board == AMM)
+		nresPin = SC_NRES;
+
+	// set port direction specifiers once, ioctls only touch the data registers
+	if (nresPin)
+	{
+		// keep the current reset level when the pin becomes an output
+		writel(nresPin,(readl(piocBase+PIO_PDSR)&nresPin)?piocBase+PIO_SODR:piocBase+PIO_CODR);
+		writel(nresPin|LG_TXRDY, piocBase+PIO_PER);	// PIO enable
+		writel(nresPin, piocBase+PIO_OER);			// OUTPUT enable
+		writel(LG_TXRDY, piocBase+PIO_ODR);			// OUTPUT disable
+	}
 	writel(1<<ID_PIOC,pmcBase+PMC_SCER);		// enable PIOC clock
 
-	// detect AMx board/sytem type
-	// 
-	// Pin:			Value:	Board:					Signal:			Remarks
-	// -------------------------------------------------------------------------------------------
-	// [PIOC-31]	= 0		Access Manager MIFARE	SC_NRES = 0		Pull-Down an Security Chip
-	//				= 1		Access Manger LEGIC		n.A.			Internal Pull-Up CPU
-	// [PIOC-30]	= 0		Access Manager LEGIC	LG_NRES = 0		Pull-Down an Legic Chip	
-	//				= 1		n.A. 
-	writel(LG_NRES|SC_NRES,piocBase+PIO_PUER);		// pull-up enable
-	writel(LG_NRES|SC_NRES,piocBase+PIO_ODR);		// output disable
-	udelay(1000);
-
-	if (readl(piocBase+PIO_PDSR)&SC_NRES)
+	// TX_READY edge interrupt (LEGIC only)
+	if (board == AML)
 	{
-		if (readl(piocBase+PIO_PDSR)&LG_NRES)
-			board = AM3;	
-		else
-			board = AML;			
-	} 
-	else
-		board = AMM;			
-		
+		txrdyIrq = gpio_to_irq(LG_TXRDY_GPIO);
+		res = request_irq(txrdyIrq, amx_txrdy_irq, 0, "amx", NULL);
+		if (res) {
+			printk("<0>amx: cannot request TX_READY irq %d\n", txrdyIrq);
+			txrdyIrq = -1;
+		}
+	}
+
 	// everything initialized
 	if (board==AMM)
 		printk("<0>amx: module initialized - board type is AM-M\n");
@@ -206,6 +371,8 @@ int amx_init(void)
  *---------------------------------------------------------------------------*/
 void amx_exit(void) 
 {
+	if (txrdyIrq >= 0)
+		free_irq(txrdyIrq, NULL);
 	unregister_chrdev(AMX_MAJOR, "amx");
 
 	/* unmap piocBase */
@@ -34,6 +34,16 @@ typedef struct _DRVMSG
 									// '3' => AM300
 } DRVMSG;
 
+// Reset pulse parameters for IOCTL_AMX_RESET_PULSE
+typedef struct _PULSEMSG
+{
+	unsigned int	low;			// NRES low time [us]
+	unsigned int	settle;			// delay after NRES is released [us]
+	unsigned int	timeout;		// then wait for TX_READY [ms], 0 = don't wait
+} PULSEMSG;
+
+#define AMX_PULSE_MAX		1000000		// upper limit for low and settle [us]
+
 // Bitmask definitions for PINS
 #define HIGH		0x01
 #define LOW			0x00
@@ -42,6 +52,9 @@ typedef struct _DRVMSG
 #define AMX_IOC_MAGIC				'k'
 #define IOCTL_AMX_GET 				_IOWR(AMX_IOC_MAGIC, 0, int)
 #define IOCTL_AMX_SET				_IOWR(AMX_IOC_MAGIC, 1, int)
+#define IOCTL_AMX_SETGET			_IOWR(AMX_IOC_MAGIC, 2, int)	// SET, then GET
+#define IOCTL_AMX_WAIT_TXRDY	_IOWR(AMX_IOC_MAGIC, 3, int)	// arg: timeout [ms]
+#define IOCTL_AMX_RESET_PULSE	_IOWR(AMX_IOC_MAGIC, 4, int)
 
 #ifdef __cplusplus
 } /* extern "C"*/
@@ -0,0 +1,50 @@
+/* vi: set sw=2 ts=2 tw=80: */
+/******************************************************************************
+ * avr9.h
+ *
+ * Line discipline for the 9-bit AVR co-processor link (ttyS4)
+ *
+ * Copyright (C) 2012 KABA AG, MIC AWM
+ *
+ * Distributed under the terms of the GNU General Public License
+ * This software may be used without warrany provided and
+ * copyright statements are left intact.
+ *
+ *****************************************************************************/
+#ifndef _AVR9_LDISC_H
+#define _AVR9_LDISC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Line discipline number, see N_AVR9 in <linux/tty.h>
+#define AVR9_LDISC				19
+
+// A frame starts with a character that has the 9th bit set (address byte),
+// followed by up to AVR9_MAX_DATA characters with the 9th bit cleared.
+// read() returns one frame per call and write() takes one frame per call,
+// both in the same layout: buf[0] = address, buf[1..n] = data.
+#define AVR9_MAX_DATA			256
+#define AVR9_MAX_FRAME		(1 + AVR9_MAX_DATA)
+
+// Frame statistics for IOCTL_AVR9_GETSTATS
+typedef struct _AVR9STATS
+{
+	unsigned long	rxFrames;		// frames delivered to the receive queue
+	unsigned long	txFrames;		// frames handed to the UART
+	unsigned long	rxDropped;	// frames lost because the queue was full
+	unsigned long	rxErrors;		// frames discarded (too long, no address,
+														// framing/parity/overrun error)
+} AVR9STATS;
+
+// IOCTL codes
+#define AVR9_IOC_MAGIC			'9'
+#define IOCTL_AVR9_GETSTATS	_IOWR(AVR9_IOC_MAGIC, 0, int)
+#define IOCTL_AVR9_SETGAP		_IOWR(AVR9_IOC_MAGIC, 1, int)	// arg: gap [ms]
+
+#ifdef __cplusplus
+} /* extern "C"*/
+#endif
+
+#endif /*_AVR9_LDISC_H*/
@@ -0,0 +1,546 @@
+/* vi: set sw=2 ts=2 tw=80: */
+/******************************************************************************
+ * n_avr9.c
+ *
+ * Line discipline for the 9-bit AVR co-processor link (ttyS4)
+ *
+ * USART3 runs in 9-bit mode with the PDC, so every character occupies two
+ * bytes in the tty flip buffer: the data byte followed by a byte holding the
+ * 9th bit. This line discipline pairs those bytes up again, splits the stream
+ * into frames at the address marks (9th bit set) and queues whole frames, so
+ * that user space reads and writes one frame per system call.
+ *
+ * A frame ends when the next address byte arrives or when no data has been
+ * delivered for the frame gap. The gap is gap_ms milliseconds plus one
+ * jiffy, but never shorter than the serial driver's worst-case delivery
+ * latency: with the PDC, data only arrives on a full receive buffer or on
+ * the receiver timeout, so a frame that spans a buffer boundary would
+ * otherwise be cut in two.
+ *
+ * The serial driver always delivers whole (data, 9th bit) pairs per
+ * receive_buf() call: the PDC moves one halfword per character and
+ * atmel_rx_from_dma() only pushes what the PDC has completed. The pairing
+ * is therefore restarted at every call.
+ *
+ * Copyright (C) 2012 KABA AG, MIC AWM
+ *
+ * Distributed under the terms of the GNU General Public License
+ * This software may be used without warrany provided and
+ * copyright statements are left intact.
+ *
+ *****************************************************************************/
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/types.h>
+#include <linux/slab.h>
+#include <linux/tty.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/timer.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/atmel_serial.h>
+#include <asm/uaccess.h>
+#include "avr9.h"
+
+MODULE_DESCRIPTION("Line discipline for the 9-bit AVR link");
+MODULE_LICENSE("GPL");
+MODULE_ALIAS_LDISC(N_AVR9);
+
+#define AVR9_QUEUE	16		// receive queue depth (one slot stays unused)
+
+static unsigned int gapMs = 2;
+module_param_named(gap_ms, gapMs, uint, 0644);
+MODULE_PARM_DESC(gap_ms, "Idle time in ms that terminates a frame (default 2)");
+
+/*-----------------------------------------------------------------------------
+ * Per tty state
+ *
+ * Frames are assembled directly in rxQueue[rxHead]; the slot is only handed
+ * to the reader by advancing rxHead, so no copy is made in interrupt context.
+ *---------------------------------------------------------------------------*/
+typedef struct _AVR9FRAME
+{
+	unsigned int	len;
+	unsigned char	buf[AVR9_MAX_FRAME];
+} AVR9FRAME;
+
+typedef struct _AVR9
+{
+	struct tty_struct *tty;
+	spinlock_t		lock;						// protects the receive state and queue
+	unsigned char	low;						// data byte waiting for its 9th bit byte
+	unsigned char	haveLow;
+	unsigned char	inFrame;				// an address byte has been received
+	unsigned char	discard;				// current frame is dropped
+	AVR9FRAME			rxQueue[AVR9_QUEUE];
+	unsigned int	rxHead, rxTail;
+	unsigned int	gapMs;					// requested frame gap [ms]
+	unsigned long	gap;						// effective frame gap [jiffies]
+	struct timer_list gapTimer;
+	struct mutex	readLock;
+	struct mutex	writeLock;
+	unsigned char	txBuf[2*AVR9_MAX_FRAME];
+	AVR9STATS			stats;
+} AVR9;
+
+/*-----------------------------------------------------------------------------
+ * avr9_rx_reset()
+ *
+ * Forget any partial character and frame. Called with lock held.
+ *---------------------------------------------------------------------------*/
+static void avr9_rx_reset(AVR9 *avr9)
+{
+	avr9->haveLow = 0;
+	avr9->inFrame = 0;
+	avr9->discard = 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * avr9_update_gap()
+ *
+ * Compute the effective frame gap from the requested one and the receive
+ * latency of the serial port (see the header comment).
+ *---------------------------------------------------------------------------*/
+static void avr9_update_gap(AVR9 *avr9)
+{
+	unsigned long gap, minGap;
+
+	gap = msecs_to_jiffies(avr9->gapMs) + 1;
+	minGap = usecs_to_jiffies(atmel_serial_rx_latency(avr9->tty)) + 1;
+	avr9->gap = max(gap, minGap);
+}
+
+/*-----------------------------------------------------------------------------
+ * avr9_end_frame()
+ *
+ * Terminate the frame being assembled. Returns 1 if a frame was queued.
+ * Called with lock held.
+ *---------------------------------------------------------------------------*/
+static int avr9_end_frame(AVR9 *avr9)
+{
+	if (!avr9->inFrame)
+		return 0;
+
+	avr9->inFrame = 0;
+	if (avr9->discard)
+		return 0;
+
+	avr9->rxHead = (avr9->rxHead + 1) % AVR9_QUEUE;
+	avr9->stats.rxFrames++;
+	return 1;
+}
+
+/*-----------------------------------------------------------------------------
+ * avr9_rx_char()
+ *
+ * Add one 9-bit character to the current frame. Returns 1 if a frame was
+ * queued. Called with lock held.
+ *---------------------------------------------------------------------------*/
+static int avr9_rx_char(AVR9 *avr9, unsigned char ch, int address)
+{
+	AVR9FRAME *frame = &avr9->rxQueue[avr9->rxHead];
+	int queued = 0;
+
+	if (address) {
+		queued = avr9_end_frame(avr9);
+		frame = &avr9->rxQueue[avr9->rxHead];
+		avr9->inFrame = 1;
+		avr9->discard = 0;
+		if ((avr9->rxHead + 1) % AVR9_QUEUE == avr9->rxTail) {
+			avr9->stats.rxDropped++;
+			avr9->discard = 1;
+			return queued;
+		}
+		frame->buf[0] = ch;
+		frame->len = 1;
+		return queued;
+	}
+
+	if (!avr9->inFrame) {
+		// data without a preceding address byte
+		avr9->stats.rxErrors++;
+		return 0;
+	}
+	if (avr9->discard)
+		return 0;
+	if (frame->len >= AVR9_MAX_FRAME) {
+		avr9->stats.rxErrors++;
+		avr9->discard = 1;
+		return 0;
+	}
+	frame->buf[frame->len++] = ch;
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * avr9_gap_timeout()
+ *
+ * The line has been idle for the frame gap, hand out the current frame.
+ *---------------------------------------------------------------------------*/
+static void avr9_gap_timeout(unsigned long data)
+{
+	AVR9 *avr9 = (AVR9 *)data;
+	unsigned long flags;
+	int queued;
+
+	spin_lock_irqsave(&avr9->lock, flags);
+	queued = avr9_end_frame(avr9);
+	spin_unlock_irqrestore(&avr9->lock, flags);
+
+	if (queued)
+		wake_up_interruptible(&avr9->tty->read_wait);
+}
+
+/*-----------------------------------------------------------------------------
+ * avr9_receive_buf()
+ *
+ * Called by the flip buffer with a chunk of received bytes. Each 9-bit
+ * character is a (data, 9th bit) byte pair in little endian order.
+ *---------------------------------------------------------------------------*/
+static void avr9_receive_buf(struct tty_struct *tty, const unsigned char *cp,
+														 char *fp, int count)
+{
+	AVR9 *avr9 = tty->disc_data;
+	unsigned long flags;
+	int queued = 0;
+	int i;
+
+	if (!avr9)
+		return;
+
+	spin_lock_irqsave(&avr9->lock, flags);
+	if (avr9->haveLow) {
+		// a call never ends in the middle of a character, see above
+		avr9->stats.rxErrors++;
+		avr9->discard = avr9->inFrame;
+		avr9->haveLow = 0;
+	}
+	for (i=0; i<count; i++) {
+		if (fp && fp[i] != TTY_NORMAL) {
+			// framing/parity/overrun error, drop the frame it belongs to
+			if (avr9->inFrame && !avr9->discard) {
+				avr9->stats.rxErrors++;
+				avr9->discard = 1;
+			}
+			avr9->haveLow = 0;
+			continue;
+		}
+		if (!avr9->haveLow) {
+			avr9->low = cp[i];
+			avr9->haveLow = 1;
+			continue;
+		}
+		if (cp[i] > 1) {
+			// not a 9th bit byte, the pairing is off by one: resync
+			avr9->stats.rxErrors++;
+			avr9->discard = avr9->inFrame;
+			avr9->low = cp[i];
+			continue;
+		}
+		avr9->haveLow = 0;
+		queued |= avr9_rx_char(avr9, avr9->low, cp[i]);
+	}
+	if (avr9->inFrame)
+		mod_timer(&avr9->gapTimer, jiffies + avr9->gap);
+	spin_unlock_irqrestore(&avr9->lock, flags);
+
+	if (queued)
+		wake_up_interruptible(&tty->read_wait);
+}
+
+/*-----------------------------------------------------------------------------
+ * avr9_read()
+ *
+ * Return one frame: buf[0] = address byte, buf[1..] = data bytes. If the
+ * frame does not fit (-EOVERFLOW) or can't be copied (-EFAULT) it stays
+ * queued, so the caller can retry with a larger buffer.
+ *---------------------------------------------------------------------------*/
+static ssize_t avr9_read(struct tty_struct *tty, struct file *file,
+												 unsigned char __user *buf, size_t nr)
+{
+	AVR9 *avr9 = tty->disc_data;
+	AVR9FRAME *frame;
+	ssize_t ret;
+
+	if (!avr9)
+		return -EIO;
+
+	if (mutex_lock_interruptible(&avr9->readLock))
+		return -ERESTARTSYS;
+
+	while (avr9->rxHead == avr9->rxTail) {
+		if (test_bit(TTY_OTHER_CLOSED, &tty->flags) || tty_hung_up_p(file)) {
+			ret = -EIO;
+			goto out;
+		}
+		if (file->f_flags & O_NONBLOCK) {
+			ret = -EAGAIN;
+			goto out;
+		}
+		if (wait_event_interruptible(tty->read_wait,
+					avr9->rxHead != avr9->rxTail ||
+					test_bit(TTY_OTHER_CLOSED, &tty->flags) ||
+					tty_hung_up_p(file))) {
+			ret = -ERESTARTSYS;
+			goto out;
+		}
+	}
+
+	// the slot at rxTail is not touched by the receive path
+	frame = &avr9->rxQueue[avr9->rxTail];
+	if (frame->len > nr)
+		ret = -EOVERFLOW;
+	else if (copy_to_user(buf, frame->buf, frame->len))
+		ret = -EFAULT;
+	else {
+		ret = frame->len;
+
+		spin_lock_irq(&avr9->lock);
+		avr9->rxTail = (avr9->rxTail + 1) % AVR9_QUEUE;
+		spin_unlock_irq(&avr9->lock);
+	}
+out:
+	mutex_unlock(&avr9->readLock);
+	return ret;
+}
+
+/*-----------------------------------------------------------------------------
+ * avr9_write()
+ *
+ * Send one frame: data[0] = address byte, data[1..] = data bytes. The frame
+ * is only passed to the UART once it fits completely into the transmit
+ * buffer, so frames from different writers never interleave.
+ *---------------------------------------------------------------------------*/
+static ssize_t avr9_write(struct tty_struct *tty, struct file *file,
+													const unsigned char *data, size_t count)
+{
+	AVR9 *avr9 = tty->disc_data;
+	unsigned char *tx;
+	size_t i;
+	int len, ret;
+
+	if (!avr9)
+		return -EIO;
+	if (count < 1 || count > AVR9_MAX_FRAME)
+		return -EINVAL;
+
+	if (mutex_lock_interruptible(&avr9->writeLock))
+		return -ERESTARTSYS;
+
+	tx = avr9->txBuf;
+	for (i=0; i<count; i++) {
+		*tx++ = data[i];
+		*tx++ = (i == 0);					// 9th bit marks the address byte
+	}
+	len = tx - avr9->txBuf;
+
+	while (tty_write_room(tty) < len) {
+		if (tty_hung_up_p(file)) {
+			ret = -EIO;
+			goto out;
+		}
+		if (file->f_flags & O_NONBLOCK) {
+			ret = -EAGAIN;
+			goto out;
+		}
+		if (wait_event_interruptible(tty->write_wait,
+					tty_write_room(tty) >= len || tty_hung_up_p(file))) {
+			ret = -ERESTARTSYS;
+			goto out;
+		}
+	}
+
+	ret = tty->ops->write(tty, avr9->txBuf, len);
+	if (ret == len) {
+		avr9->stats.txFrames++;
+		ret = count;
+	} else if (ret >= 0)
+		ret = -EIO;
+out:
+	mutex_unlock(&avr9->writeLock);
+	return ret;
+}
+
+/*-----------------------------------------------------------------------------
+ * avr9_poll()
+ *---------------------------------------------------------------------------*/
+static unsigned int avr9_poll(struct tty_struct *tty, struct file *file,
+															poll_table *wait)
+{
+	AVR9 *avr9 = tty->disc_data;
+	unsigned int mask = 0;
+
+	if (!avr9)
+		return POLLERR;
+
+	poll_wait(file, &tty->read_wait, wait);
+	poll_wait(file, &tty->write_wait, wait);
+
+	if (avr9->rxHead != avr9->rxTail)
+		mask |= POLLIN | POLLRDNORM;
+	if (test_bit(TTY_OTHER_CLOSED, &tty->flags) || tty_hung_up_p(file))
+		mask |= POLLHUP;
+	if (tty_write_room(tty) >= 2*AVR9_MAX_FRAME)
+		mask |= POLLOUT | POLLWRNORM;
+	return mask;
+}
+
+/*-----------------------------------------------------------------------------
+ * avr9_ioctl()
+ *---------------------------------------------------------------------------*/
+static int avr9_ioctl(struct tty_struct *tty, struct file *file,
+											unsigned int cmd, unsigned long arg)
+{
+	AVR9 *avr9 = tty->disc_data;
+	AVR9STATS stats;
+
+	if (!avr9)
+		return -EIO;
+
+	switch (cmd) {
+	case IOCTL_AVR9_GETSTATS:
+		spin_lock_irq(&avr9->lock);
+		stats = avr9->stats;
+		spin_unlock_irq(&avr9->lock);
+		if (copy_to_user((void __user *)arg, &stats, sizeof(stats)))
+			return -EFAULT;
+		return 0;
+
+	case IOCTL_AVR9_SETGAP:
+		if (arg < 1 || arg > 1000)
+			return -EINVAL;
+		avr9->gapMs = arg;
+		avr9_update_gap(avr9);
+		return 0;
+
+	default:
+		return n_tty_ioctl_helper(tty, file, cmd, arg);
+	}
+}
+
+/*-----------------------------------------------------------------------------
+ * avr9_flush_buffer()
+ *
+ * Drop all received frames and the partial one.
+ *---------------------------------------------------------------------------*/
+static void avr9_flush_buffer(struct tty_struct *tty)
+{
+	AVR9 *avr9 = tty->disc_data;
+	unsigned long flags;
+
+	if (!avr9)
+		return;
+
+	spin_lock_irqsave(&avr9->lock, flags);
+	avr9_rx_reset(avr9);
+	avr9->rxTail = avr9->rxHead;
+	spin_unlock_irqrestore(&avr9->lock, flags);
+}
+
+/*-----------------------------------------------------------------------------
+ * avr9_set_termios()
+ *
+ * The receive latency depends on the line settings.
+ *---------------------------------------------------------------------------*/
+static void avr9_set_termios(struct tty_struct *tty, struct ktermios *old)
+{
+	AVR9 *avr9 = tty->disc_data;
+
+	if (avr9)
+		avr9_update_gap(avr9);
+}
+
+/*-----------------------------------------------------------------------------
+ * avr9_open()
+ *---------------------------------------------------------------------------*/
+static int avr9_open(struct tty_struct *tty)
+{
+	AVR9 *avr9;
+
+	avr9 = kzalloc(sizeof(*avr9), GFP_KERNEL);
+	if (!avr9)
+		return -ENOMEM;
+
+	avr9->tty = tty;
+	spin_lock_init(&avr9->lock);
+	mutex_init(&avr9->readLock);
+	mutex_init(&avr9->writeLock);
+	avr9->gapMs = gapMs ? gapMs : 1;
+	avr9_update_gap(avr9);
+	setup_timer(&avr9->gapTimer, avr9_gap_timeout, (unsigned long)avr9);
+
+	tty->disc_data = avr9;
+	tty->receive_room = 65536;
+	tty_driver_flush_buffer(tty);
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * avr9_close()
+ *---------------------------------------------------------------------------*/
+static void avr9_close(struct tty_struct *tty)
+{
+	AVR9 *avr9 = tty->disc_data;
+
+	if (!avr9)
+		return;
+
+	tty->disc_data = NULL;
+	del_timer_sync(&avr9->gapTimer);
+	kfree(avr9);
+}
+
+/*-----------------------------------------------------------------------------
+ * avr9_hangup()
+ *---------------------------------------------------------------------------*/
+static int avr9_hangup(struct tty_struct *tty)
+{
+	wake_up_interruptible(&tty->read_wait);
+	wake_up_interruptible(&tty->write_wait);
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * line discipline operations
+ *---------------------------------------------------------------------------*/
+static struct tty_ldisc_ops avr9_ldisc = {
+	owner:				THIS_MODULE,
+	magic:				TTY_LDISC_MAGIC,
+	name:					"avr9",
+	open:					avr9_open,
+	close:				avr9_close,
+	flush_buffer:	avr9_flush_buffer,
+	read:					avr9_read,
+	write:				avr9_write,
+	ioctl:				avr9_ioctl,
+	set_termios:	avr9_set_termios,
+	poll:					avr9_poll,
+	hangup:				avr9_hangup,
+	receive_buf:	avr9_receive_buf,
+};
+
+/*-----------------------------------------------------------------------------
+ * avr9_init()
+ *---------------------------------------------------------------------------*/
+static int __init avr9_init(void)
+{
+	int ret;
+
+	ret = tty_register_ldisc(N_AVR9, &avr9_ldisc);
+	if (ret)
+		printk("<0>AVR9: can't register line discipline %d (%d)\n", N_AVR9, ret);
+	return ret;
+}
+
+/*-----------------------------------------------------------------------------
+ * avr9_exit()
+ *---------------------------------------------------------------------------*/
+static void __exit avr9_exit(void)
+{
+	tty_unregister_ldisc(N_AVR9);
+}
+
+module_init(avr9_init);
+module_exit(avr9_exit);
@@ -21,6 +21,15 @@
 #include <linux/delay.h>
 #include <linux/fs.h>
 #include <linux/types.h>
+#include <linux/spinlock.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/interrupt.h>
+#include <linux/timer.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/time.h>
+#include <mach/gpio.h>
 #include <asm/uaccess.h>
 #include <asm/io.h>
 #include <asm/system.h>
@@ -39,7 +48,9 @@ MODULE_LICENSE("GPL");
 #define PIO_ODR					0x14
 #define PIO_SODR				0x30
 #define PIO_CODR				0x34	
+#define PIO_ODSR				0x38
 #define PIO_PDSR				0x3C
+#define PIO_OWER				0xA0
 
 #define STATE_RED				(1<<7)
 #define OUT1_RED				(1<<21)
@@ -51,11 +62,59 @@ MODULE_LICENSE("GPL");
 #define OUT2_GREEN			(1<<26)
 #define OUT3_GREEN			(1<<27)
 #define RESET						(1<<14)
+#define RESET_GPIO			AT91_PIN_PC14
+
+#define LEDOUT_PINS			(STATE_RED|OUT1_RED|OUT2_RED|OUT3_RED|STATE_GREEN|OUT1_GREEN|OUT2_GREEN|OUT3_GREEN)
+
+/*-----------------------------------------------------------------------------
+ * Precomputed pin masks, indexed by bit number of LEDOUT_xxx
+ *
+ * All outputs are on PIOC and enabled for synchronous ODSR writes, so a new
+ * output state is applied to every pin with one register write.
+ *---------------------------------------------------------------------------*/
+static const u32 ledoutPin[8] = {
+	STATE_RED, STATE_GREEN, OUT1_RED, OUT1_GREEN,
+	OUT2_RED, OUT2_GREEN, OUT3_RED, OUT3_GREEN
+};
 
 /*-----------------------------------------------------------------------------
  * Global register access pointer
  *---------------------------------------------------------------------------*/
 static void * memBase;
+static DEFINE_SPINLOCK(ledoutLock);			// protects ODSR read-modify-write
+
+/*-----------------------------------------------------------------------------
+ * Pattern sequencer state
+ *
+ * seqQueue[seqFirst] is the pattern being played, up to LEDOUT_SEQ_QUEUE
+ * further patterns wait behind it. The hrtimer callback steps through the
+ * pattern without any help from user space.
+ *---------------------------------------------------------------------------*/
+static SEQMSG seqQueue[LEDOUT_SEQ_QUEUE+1];
+static unsigned int seqFirst, seqCount;	// ring of queued patterns
+static unsigned int seqStep;						// current step of the playing pattern
+static unsigned int seqRun;							// completed runs of the playing pattern
+static struct hrtimer seqTimer;
+static DEFINE_SPINLOCK(seqLock);
+
+/*-----------------------------------------------------------------------------
+ * Reset button state
+ *
+ * Every edge of the reset button raises the PIOC change interrupt. The first
+ * edge is timestamped and starts the debounce timer; the timer samples the
+ * settled level and queues a press/release event if it changed.
+ *---------------------------------------------------------------------------*/
+static int rstIrq = -1;
+static struct timer_list rstTimer;
+static ktime_t rstEdge;									// time of the first edge of a bounce
+static struct timeval rstEdgeTv;
+static ktime_t rstPressTime;						// time of the last press
+static unsigned char rstState;					// last debounced state
+static RSTEVENT rstQueue[LEDOUT_RST_QUEUE];
+static unsigned int rstHead, rstTail;
+static DEFINE_SPINLOCK(rstLock);
+static DECLARE_WAIT_QUEUE_HEAD(rstWait);
+static struct fasync_struct *rstAsync;
 
 /*-----------------------------------------------------------------------------
  * forward function declaration
@@ -63,6 +122,10 @@ static void * memBase;
 void ledout_exit(void);
 int ledout_init(void);
 int ledout_ioctl(struct inode*, struct file* , unsigned int, unsigned long);
+ssize_t ledout_read(struct file*, char __user*, size_t, loff_t*);
+unsigned int ledout_poll(struct file*, poll_table*);
+int ledout_fasync(int, struct file*, int);
+int ledout_release(struct inode*, struct file*);
 module_init(ledout_init);
 module_exit(ledout_exit);
 
@@ -72,14 +135,303 @@ module_exit(ledout_exit);
 struct file_operations ledout_fops = {
 	owner:	THIS_MODULE,
 	ioctl:	ledout_ioctl,
+	read:		ledout_read,
+	poll:		ledout_poll,
+	fasync:	ledout_fasync,
+	release:	ledout_release,
 };
 
+/*-----------------------------------------------------------------------------
+ * ledout_bits_to_pins()
+ *
+ * Translate a LEDOUT_xxx bitmap into PIOC pin bits.
+ *---------------------------------------------------------------------------*/
+static u32 ledout_bits_to_pins(unsigned char bits)
+{
+	u32 pins = 0;
+	int i;
+
+	for (i=0; bits; i++, bits>>=1)
+		if (bits & 1)
+			pins |= ledoutPin[i];
+
+	return pins;
+}
+
+/*-----------------------------------------------------------------------------
+ * ledout_drvmsg_to_bits()
+ *
+ * Translate the colour values of a DRVMSG into a LEDOUT_xxx bitmap.
+ *---------------------------------------------------------------------------*/
+static unsigned char ledout_drvmsg_to_bits(const DRVMSG *drvMsg)
+{
+	return (drvMsg->state&ORANGE) | ((drvMsg->out1&ORANGE)<<2) |
+		((drvMsg->out2&ORANGE)<<4) | ((drvMsg->out3&ORANGE)<<6);
+}
+
+/*-----------------------------------------------------------------------------
+ * ledout_update()
+ *
+ * Clear and then set the given output pins with a single ODSR write, so that
+ * all LEDs and relays switch at the same time.
+ *---------------------------------------------------------------------------*/
+static void ledout_update(u32 clear, u32 set)
+{
+	unsigned long flags;
+	u32 odsr = 0;
+
+	spin_lock_irqsave(&ledoutLock, flags);
+	if ((clear & LEDOUT_PINS) != LEDOUT_PINS)
+		odsr = readl(memBase+PIO_ODSR);
+	writel((odsr & ~clear) | set, memBase+PIO_ODSR);
+	spin_unlock_irqrestore(&ledoutLock, flags);
+}
+
+/*-----------------------------------------------------------------------------
+ * ledout_seq_apply()
+ *
+ * Apply the current step of the playing pattern and return its duration.
+ * Caller holds seqLock and seqCount > 0.
+ *---------------------------------------------------------------------------*/
+static ktime_t ledout_seq_apply(void)
+{
+	SEQMSG *seq = &seqQueue[seqFirst];
+	SEQSTEP *step = &seq->step[seqStep];
+	u32 mask = ledout_bits_to_pins(seq->mask);
+
+	ledout_update(mask, ledout_bits_to_pins(step->outputs) & mask);
+	return ktime_set(step->duration / 1000, (step->duration % 1000) * NSEC_PER_MSEC);
+}
+
+/*-----------------------------------------------------------------------------
+ * ledout_seq_timer()
+ *
+ * Advance to the next step, the next run or the next queued pattern.
+ *---------------------------------------------------------------------------*/
+static enum hrtimer_restart ledout_seq_timer(struct hrtimer *timer)
+{
+	enum hrtimer_restart ret = HRTIMER_NORESTART;
+	unsigned long flags;
+	SEQMSG *seq;
+
+	spin_lock_irqsave(&seqLock, flags);
+	if (seqCount == 0)
+		goto out;
+
+	seq = &seqQueue[seqFirst];
+	if (++seqStep >= seq->nrOfSteps)
+	{
+		seqStep = 0;
+		if (seq->repeat && ++seqRun >= seq->repeat)
+		{
+			// pattern finished, continue with the next queued one
+			seqFirst = (seqFirst + 1) % ARRAY_SIZE(seqQueue);
+			seqRun = 0;
+			if (--seqCount == 0)
+				goto out;
+		}
+	}
+
+	hrtimer_forward_now(timer, ledout_seq_apply());
+	ret = HRTIMER_RESTART;
+out:
+	spin_unlock_irqrestore(&seqLock, flags);
+	return ret;
+}
+
+/*-----------------------------------------------------------------------------
+ * ledout_seq_play()
+ *
+ * IOCTL_LEDOUT_PLAY: start a pattern immediately, or append it to the queue
+ * when LEDOUT_SEQ_APPEND is set and a pattern is already playing.
+ *---------------------------------------------------------------------------*/
+static int ledout_seq_play(SEQMSG *seq)
+{
+	unsigned long flags;
+	ktime_t first;
+	int i;
+
+	if (seq->nrOfSteps == 0 || seq->nrOfSteps > LEDOUT_SEQ_STEPS)
+		return -EINVAL;
+	for (i=0; i<seq->nrOfSteps; i++)
+		if (seq->step[i].duration == 0)
+			return -EINVAL;
+
+	if ((seq->flags & LEDOUT_SEQ_APPEND) == 0)
+		hrtimer_cancel(&seqTimer);
+
+	spin_lock_irqsave(&seqLock, flags);
+	if ((seq->flags & LEDOUT_SEQ_APPEND) && seqCount)
+	{
+		if (seqCount == ARRAY_SIZE(seqQueue))
+		{
+			spin_unlock_irqrestore(&seqLock, flags);
+			return -EBUSY;
+		}
+		seqQueue[(seqFirst + seqCount) % ARRAY_SIZE(seqQueue)] = *seq;
+		seqCount++;
+		spin_unlock_irqrestore(&seqLock, flags);
+		return 0;
+	}
+
+	// preempt whatever is playing and drop the queue
+	seqQueue[seqFirst] = *seq;
+	seqCount = 1;
+	seqStep = 0;
+	seqRun = 0;
+	first = ledout_seq_apply();
+	spin_unlock_irqrestore(&seqLock, flags);
+
+	hrtimer_start(&seqTimer, first, HRTIMER_MODE_REL);
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * ledout_seq_stop()
+ *
+ * Stop the sequencer and drop all queued patterns. The outputs keep the
+ * state of the last played step.
+ *---------------------------------------------------------------------------*/
+static void ledout_seq_stop(void)
+{
+	unsigned long flags;
+
+	hrtimer_cancel(&seqTimer);
+	spin_lock_irqsave(&seqLock, flags);
+	seqCount = 0;
+	spin_unlock_irqrestore(&seqLock, flags);
+}
+
+/*-----------------------------------------------------------------------------
+ * ledout_rst_irq()
+ *
+ * PIOC change interrupt of the reset button.
+ *---------------------------------------------------------------------------*/
+static irqreturn_t ledout_rst_irq(int irq, void *dev_id)
+{
+	if (!timer_pending(&rstTimer))
+	{
+		rstEdge = ktime_get();
+		do_gettimeofday(&rstEdgeTv);
+		mod_timer(&rstTimer, jiffies + msecs_to_jiffies(LEDOUT_RST_DEBOUNCE_MS));
+	}
+	return IRQ_HANDLED;
+}
+
+/*-----------------------------------------------------------------------------
+ * ledout_rst_timer()
+ *
+ * Debounce timer: queue an event if the settled button state changed.
+ *---------------------------------------------------------------------------*/
+static void ledout_rst_timer(unsigned long data)
+{
+	unsigned char state = ((readl(memBase+PIO_PDSR)&RESET)>0);
+	RSTEVENT *ev;
+
+	if (state == rstState)
+		return;
+	rstState = state;
+
+	spin_lock(&rstLock);
+	ev = &rstQueue[rstHead % LEDOUT_RST_QUEUE];
+	memset(ev, 0, sizeof(*ev));
+	if (rstHead - rstTail == LEDOUT_RST_QUEUE)
+	{
+		rstTail++;
+		ev->flags |= RSTEVENT_OVERFLOW;
+	}
+	ev->sec = rstEdgeTv.tv_sec;
+	ev->usec = rstEdgeTv.tv_usec;
+	ev->reset = state;
+	if (state == RESET_ACTIVE)
+		rstPressTime = rstEdge;
+	else
+		ev->hold = (u32)ktime_us_delta(rstEdge, rstPressTime) / 1000;
+	rstHead++;
+	spin_unlock(&rstLock);
+
+	wake_up_interruptible(&rstWait);
+	kill_fasync(&rstAsync, SIGIO, POLL_IN);
+}
+
+/*-----------------------------------------------------------------------------
+ * ledout_read()
+ *
+ * Return as many whole RSTEVENT records as fit into the user buffer. Blocks
+ * until a button event occurs unless O_NONBLOCK is set.
+ *---------------------------------------------------------------------------*/
+ssize_t ledout_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+	RSTEVENT ev;
+	ssize_t ret = 0;
+
+	if (count < sizeof(ev))
+		return -EINVAL;
+
+	if (rstHead == rstTail)
+	{
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(rstWait, rstHead != rstTail))
+			return -ERESTARTSYS;
+	}
+
+	while (ret + sizeof(ev) <= count)
+	{
+		spin_lock_bh(&rstLock);
+		if (rstHead == rstTail)
+		{
+			spin_unlock_bh(&rstLock);
+			break;
+		}
+		ev = rstQueue[rstTail % LEDOUT_RST_QUEUE];
+		rstTail++;
+		spin_unlock_bh(&rstLock);
+
+		if (copy_to_user(buf + ret, &ev, sizeof(ev)))
+			return -EFAULT;
+		ret += sizeof(ev);
+	}
+
+	return ret;
+}
+
+/*-----------------------------------------------------------------------------
+ * ledout_poll()
+ *---------------------------------------------------------------------------*/
+unsigned int ledout_poll(struct file *file, poll_table *wait)
+{
+	poll_wait(file, &rstWait, wait);
+	if (rstHead != rstTail)
+		return POLLIN | POLLRDNORM;
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * ledout_fasync()
+ *---------------------------------------------------------------------------*/
+int ledout_fasync(int fd, struct file *file, int mode)
+{
+	return fasync_helper(fd, file, mode, &rstAsync);
+}
+
+/*-----------------------------------------------------------------------------
+ * ledout_release()
+ *---------------------------------------------------------------------------*/
+int ledout_release(struct inode *inode, struct file *file)
+{
+	ledout_fasync(-1, file, 0);
+	return 0;
+}
+
 /*-----------------------------------------------------------------------------
  * ledout_ioctl()
  *---------------------------------------------------------------------------*/
 int ledout_ioctl(struct inode *inode, struct file *file, unsigned int cmd, unsigned long arg)
 {
 	DRVMSG drvMsg;
+	MASKMSG maskMsg;
+	SEQMSG seqMsg;
 	int ret, regval;
 	
 	switch (cmd)
@@ -91,7 +443,7 @@ int ledout_ioctl(struct inode *inode, struct file *file, unsigned int cmd, unsig
 			drvMsg.out1 = RED*((regval&OUT1_RED)>0) + GREEN*((regval&OUT1_GREEN)>0);
 			drvMsg.out2 = RED*((regval&OUT2_RED)>0) + GREEN*((regval&OUT2_GREEN)>0);
 			drvMsg.out3 = RED*((regval&OUT3_RED)>0) + GREEN*((regval&OUT3_GREEN)>0);
-			drvMsg.reset = ((readl(memBase+PIO_PDSR)&RESET)>0); 
+			drvMsg.reset = ((regval&RESET)>0); 
 
 			ret=copy_to_user((void*)arg,&drvMsg, sizeof(drvMsg));
 		 	if (ret!=0){
@@ -107,14 +459,34 @@ int ledout_ioctl(struct inode *inode, struct file *file, unsigned int cmd, unsig
 			if(ret)	
 				return -EFAULT;
 
-			writel(STATE_RED, (drvMsg.state&RED)?memBase+PIO_SODR:memBase+PIO_CODR);
-			writel(STATE_GREEN, (drvMsg.state&GREEN)?memBase+PIO_SODR:memBase+PIO_CODR);
-			writel(OUT1_RED, (drvMsg.out1&RED)?memBase+PIO_SODR:memBase+PIO_CODR);
-			writel(OUT1_GREEN, (drvMsg.out1&GREEN)?memBase+PIO_SODR:memBase+PIO_CODR);
-			writel(OUT2_RED, (drvMsg.out2&RED)?memBase+PIO_SODR:memBase+PIO_CODR);
-			writel(OUT2_GREEN, (drvMsg.out2&GREEN)?memBase+PIO_SODR:memBase+PIO_CODR);
-			writel(OUT3_RED, (drvMsg.out3&RED)?memBase+PIO_SODR:memBase+PIO_CODR);
-			writel(OUT3_GREEN, (drvMsg.out3&GREEN)?memBase+PIO_SODR:memBase+PIO_CODR);
+			ledout_update(LEDOUT_PINS, ledout_bits_to_pins(ledout_drvmsg_to_bits(&drvMsg)));
+			break;
+
+		// **************** IOCTL_LEDOUT_SETMASK ****************
+		case IOCTL_LEDOUT_SETMASK:
+
+			// get set/clear bitmaps from user space
+			ret = copy_from_user(&maskMsg,(MASKMSG*)arg, sizeof(maskMsg));
+			if(ret)	
+				return -EFAULT;
+
+			ledout_update(ledout_bits_to_pins(maskMsg.clear), ledout_bits_to_pins(maskMsg.set));
+			break;
+
+		// **************** IOCTL_LEDOUT_PLAY ****************
+		case IOCTL_LEDOUT_PLAY:
+
+			// get pattern from user space
+			ret = copy_from_user(&seqMsg,(SEQMSG*)arg, sizeof(seqMsg));
+			if(ret)	
+				return -EFAULT;
+
+			return ledout_seq_play(&seqMsg);
+
+		// **************** IOCTL_LEDOUT_STOP ****************
+		case IOCTL_LEDOUT_STOP:
+
+			ledout_seq_stop();
 			break;
 
 		default:
@@ -133,6 +505,10 @@ int ledout_init(void)
 	// register memory base 
 	memBase = ioremap_nocache(BASE_AT91_PIOC,0x200);
 
+	// pattern sequencer
+	hrtimer_init(&seqTimer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	seqTimer.function = ledout_seq_timer;
+
 	// Registering device node 
 	res = register_chrdev(LEDOUT_MAJOR,"ledout", &ledout_fops);
 	if (res < 0) {
@@ -141,10 +517,24 @@ int ledout_init(void)
 	}
 
 	// set output port direction specifiers
-	writel(STATE_RED|OUT1_RED|OUT2_RED|OUT3_RED|STATE_GREEN|OUT1_GREEN|OUT2_GREEN|OUT3_GREEN|RESET, memBase+PIO_PER);
-	writel(STATE_RED|OUT1_RED|OUT2_RED|OUT3_RED|STATE_GREEN|OUT1_GREEN|OUT2_GREEN|OUT3_GREEN, memBase+PIO_OER);
+	writel(LEDOUT_PINS|RESET, memBase+PIO_PER);
+	writel(LEDOUT_PINS, memBase+PIO_OER);
 	writel(RESET, memBase+PIO_ODR);
 
+	// allow synchronous ODSR writes on the LED/relay pins only
+	writel(LEDOUT_PINS, memBase+PIO_OWER);
+
+	// reset button interrupt with deglitch filter
+	setup_timer(&rstTimer, ledout_rst_timer, 0);
+	rstState = ((readl(memBase+PIO_PDSR)&RESET)>0);
+	at91_set_deglitch(RESET_GPIO, 1);
+	rstIrq = gpio_to_irq(RESET_GPIO);
+	res = request_irq(rstIrq, ledout_rst_irq, 0, "ledout", NULL);
+	if (res) {
+		printk("<0>ledout: cannot request reset button irq %d\n", rstIrq);
+		rstIrq = -1;
+	}
+
 	// everything initialized
 	printk("<0>ledout: module initialized\n");
 	return 0;
@@ -155,6 +545,10 @@ int ledout_init(void)
  *---------------------------------------------------------------------------*/
 void ledout_exit(void) 
 {
+	hrtimer_cancel(&seqTimer);
+	if (rstIrq >= 0)
+		free_irq(rstIrq, NULL);
+	del_timer_sync(&rstTimer);
 	unregister_chrdev(LEDOUT_MAJOR, "ledout");
 
 	/* unmap memBase */
@@ -21,6 +21,15 @@ extern "C" {
 
 #define LEDOUT_MAJOR						62
 
+// Pattern sequencer limits and flags
+#define LEDOUT_SEQ_STEPS				16
+#define LEDOUT_SEQ_QUEUE				4			// patterns waiting behind the current one
+#define LEDOUT_SEQ_APPEND				0x01	// queue after the current pattern
+
+// Reset button debounce time and event queue length
+#define LEDOUT_RST_DEBOUNCE_MS	20
+#define LEDOUT_RST_QUEUE				16
+
 // Driver data transfer structure
 typedef struct _DRVMSG
 {
@@ -31,6 +40,44 @@ typedef struct _DRVMSG
 	unsigned char reset;					// Reset Button state
 } DRVMSG;
 
+// Output bitmap transfer structure for IOCTL_LEDOUT_SETMASK
+typedef struct _MASKMSG
+{
+	unsigned char set;						// LEDOUT_xxx bits to switch on
+	unsigned char clear;					// LEDOUT_xxx bits to switch off
+} MASKMSG;
+
+// Reset button event returned by read()
+typedef struct _RSTEVENT
+{
+	unsigned int sec;							// edge timestamp (seconds)
+	unsigned int usec;						// edge timestamp (microseconds)
+	unsigned int hold;						// release: time the button was held [ms]
+	unsigned char reset;					// new button state, RESET_ACTIVE = pressed
+	unsigned char flags;					// RSTEVENT_xxx
+	unsigned char reserved[2];
+} RSTEVENT;
+
+#define RSTEVENT_OVERFLOW				0x01	// older events were dropped
+
+// Pattern sequencer step
+typedef struct _SEQSTEP
+{
+	unsigned char outputs;				// LEDOUT_xxx bits switched on during this step
+	unsigned char reserved;
+	unsigned short duration;			// step duration [ms]
+} SEQSTEP;
+
+// Pattern sequencer transfer structure for IOCTL_LEDOUT_PLAY
+typedef struct _SEQMSG
+{
+	unsigned char mask;						// LEDOUT_xxx bits controlled by the pattern
+	unsigned char repeat;					// number of runs, 0 = until preempted
+	unsigned char nrOfSteps;			// valid entries in step[]
+	unsigned char flags;					// LEDOUT_SEQ_xxx
+	SEQSTEP step[LEDOUT_SEQ_STEPS];
+} SEQMSG;
+
 // Bitmask definitions for LEDs, OUTs and RESET
 #define OFF											0x00
 #define RED											0x01
@@ -41,10 +88,23 @@ typedef struct _DRVMSG
 #define RESET_INACTIVE					0x01
 #define RESET_ACTIVE						0x00
 
+// Output bits for MASKMSG
+#define LEDOUT_STATE_RED				0x01
+#define LEDOUT_STATE_GREEN			0x02
+#define LEDOUT_OUT1_RED					0x04
+#define LEDOUT_OUT1_GREEN				0x08
+#define LEDOUT_OUT2_RED					0x10
+#define LEDOUT_OUT2_GREEN				0x20
+#define LEDOUT_OUT3_RED					0x40
+#define LEDOUT_OUT3_GREEN				0x80
+
 // IOCTL codes
 #define LEDOUT_IOC_MAGIC				'k'
 #define IOCTL_LEDOUT_GET 				_IOWR(LEDOUT_IOC_MAGIC, 0, int)
 #define IOCTL_LEDOUT_SET				_IOWR(LEDOUT_IOC_MAGIC, 1, int)
+#define IOCTL_LEDOUT_SETMASK		_IOWR(LEDOUT_IOC_MAGIC, 2, int)
+#define IOCTL_LEDOUT_PLAY				_IOWR(LEDOUT_IOC_MAGIC, 3, int)
+#define IOCTL_LEDOUT_STOP				_IOWR(LEDOUT_IOC_MAGIC, 4, int)
 
 #ifdef __cplusplus
 } /* extern "C"*/
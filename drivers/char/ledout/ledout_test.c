@@ -18,6 +18,7 @@
 #include <string.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <poll.h>
 #include "ledout.h"
 
 /*-----------------------------------------------------------------------------
@@ -29,6 +30,10 @@ int main(void)
 	int fd, ret, i;
 	char devname[20] = "/dev/ledout";
 	DRVMSG drvMsg;
+	MASKMSG maskMsg;
+	SEQMSG seqMsg;
+	RSTEVENT rstEvent;
+	struct pollfd pfd;
 
 	printf("Simple LEDOUT driver test program\r\n");
 
@@ -76,6 +81,29 @@ int main(void)
 	} 
 	printf("-> LED state test:\t\t\t[OK]\n"); 
 
+	// *** switch STATE to green and OUT1 to red with one bitmap update ***
+	maskMsg.set = LEDOUT_STATE_GREEN|LEDOUT_OUT1_RED;
+	maskMsg.clear = LEDOUT_STATE_RED|LEDOUT_OUT1_GREEN;
+	ret = ioctl(fd, IOCTL_LEDOUT_SETMASK, &maskMsg);
+	if (ret != 0)
+	{
+		printf("ioctl IOCTL_LEDOUT_SETMASK returned error 0x%X\n", ret);
+		return -1;
+	}
+	ret = ioctl(fd, IOCTL_LEDOUT_GET, &drvMsg);
+	if (ret != 0)
+	{
+		printf("ioctl IOCTL_LEDOUT_GET returned error 0x%X\n", ret);
+		return -1;
+	}
+	if ( (drvMsg.state != GREEN)||(drvMsg.out1 != RED)||(drvMsg.out2 != RED)||(drvMsg.out3 != GREEN) )
+	{
+		printf("error: wrong LED return values after SETMASK:!\n");
+		printf("state=%d out1=%d out2=%d out3=%d (0=off/1=red/2=green/3=orange)\n",drvMsg.state,drvMsg.out1,drvMsg.out2,drvMsg.out3);
+		return -1;
+	} 
+	printf("-> LED mask test:\t\t\t[OK]\n"); 
+
 	// *** get reset button state *** 
 	ret = ioctl(fd, IOCTL_LEDOUT_GET, &drvMsg);
 	if (ret != 0)
@@ -89,22 +117,60 @@ int main(void)
 		return -1;
 	}
 
-	printf("Please press and hold the reset button!\n");
-	for (i=0; i<60; i++)
+	printf("Please press and release the reset button!\n");
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	do
 	{
-		ret = ioctl(fd, IOCTL_LEDOUT_GET, &drvMsg);
-		if (ret != 0)
+		ret = poll(&pfd, 1, 60000);
+		if (ret <= 0)
 		{
-			printf("ioctl IOCTL_LEDOUT_GET returned error 0x%X\n", ret);
+			printf("-> reset button test:\t\t\t[FAIL]\n"); 
 			return -1;
 		}
-		if (drvMsg.reset == RESET_ACTIVE)
+		ret = read(fd, &rstEvent, sizeof(rstEvent));
+		if (ret != sizeof(rstEvent))
 		{
-			printf("-> reset button test:\t\t\t[OK]\n"); 
-			break;
+			printf("read returned error %d\n", ret);
+			return -1;
 		}
-		sleep(1);
+		printf("%u.%06u reset %s", rstEvent.sec, rstEvent.usec,
+			(rstEvent.reset == RESET_ACTIVE) ? "pressed\n" : "released");
+		if (rstEvent.reset != RESET_ACTIVE)
+			printf(" after %u ms\n", rstEvent.hold);
+	} while (rstEvent.reset == RESET_ACTIVE);
+	printf("-> reset button test:\t\t\t[OK]\n"); 
+
+	// *** play a STATE LED blink pattern in the kernel sequencer ***
+	memset(&seqMsg, 0, sizeof(seqMsg));
+	seqMsg.mask = LEDOUT_STATE_RED|LEDOUT_STATE_GREEN;
+	seqMsg.repeat = 10;
+	seqMsg.nrOfSteps = 2;
+	seqMsg.step[0].outputs = LEDOUT_STATE_RED;
+	seqMsg.step[0].duration = 200;
+	seqMsg.step[1].outputs = LEDOUT_STATE_GREEN;
+	seqMsg.step[1].duration = 200;
+	ret = ioctl(fd, IOCTL_LEDOUT_PLAY, &seqMsg);
+	if (ret != 0)
+	{
+		printf("ioctl IOCTL_LEDOUT_PLAY returned error 0x%X\n", ret);
+		return -1;
+	}
+
+	// queue an orange flash behind it
+	seqMsg.flags = LEDOUT_SEQ_APPEND;
+	seqMsg.repeat = 1;
+	seqMsg.nrOfSteps = 1;
+	seqMsg.step[0].outputs = LEDOUT_STATE_RED|LEDOUT_STATE_GREEN;
+	seqMsg.step[0].duration = 1000;
+	ret = ioctl(fd, IOCTL_LEDOUT_PLAY, &seqMsg);
+	if (ret != 0)
+	{
+		printf("ioctl IOCTL_LEDOUT_PLAY returned error 0x%X\n", ret);
+		return -1;
 	}
+	sleep(6);
+	printf("-> LED sequencer test:\t\t\t[OK]\n"); 
 
 	// *** set RELAIS on *** 
 	drvMsg.out1 = REL_ON;
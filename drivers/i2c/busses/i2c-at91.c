@@ -23,6 +23,10 @@
 #include <linux/init.h>
 #include <linux/clk.h>
 #include <linux/platform_device.h>
+#include <linux/interrupt.h>
+#include <linux/completion.h>
+#include <linux/dma-mapping.h>
+#include <linux/atmel_pdc.h>
 
 #include <asm/io.h>
 
@@ -38,6 +42,26 @@ MODULE_PARM_DESC(clockrate, "The TWI clockrate");
 
 static struct clk *twi_clk;
 static void __iomem *twi_base;
+static int twi_irq;
+
+/* State of the message in progress, shared with the interrupt handler */
+static unsigned char *twi_buf;
+static int twi_len;
+static int twi_error;
+static int twi_pdc_active;
+static DECLARE_COMPLETION(twi_done);
+
+/*
+ * The TWI on the AT91SAM9RL and AT91SAM9G45 has a PDC channel. Messages
+ * up to TWI_PDC_BUFSIZE bytes are then moved through a coherent bounce
+ * buffer, since i2c message buffers may live on the stack.
+ */
+#define TWI_PDC_BUFSIZE		512
+#define TWI_PDC_MIN		4	/* shorter messages aren't worth it */
+
+static int twi_has_pdc;
+static unsigned char *twi_pdc_buf;
+static dma_addr_t twi_pdc_dma;
 
 #define at91_twi_read(reg)		__raw_readl(twi_base + (reg))
 #define at91_twi_write(reg, val)	__raw_writel((val), twi_base + (reg))
@@ -46,7 +70,7 @@ static void __iomem *twi_base;
 /*
  * Initialize the TWI hardware registers.
  */
-static void __devinit at91_twi_hwinit(void)
+static void at91_twi_hwinit(void)
 {
 	unsigned long cdiv, ckdiv;
 
@@ -75,61 +99,156 @@ static void __devinit at91_twi_hwinit(void)
 }
 
 /*
- * Poll the i2c status register until the specified bit is set.
- * Returns 0 if timed out (100 msec).
+ * Interrupt handler. Moves the data byte by byte on RXRDY/TXRDY (or
+ * takes over after the PDC has done its part), sends the Stop condition
+ * and completes the message on TXCOMP.
  */
-static short at91_poll_status(unsigned long bit)
+static irqreturn_t at91_twi_interrupt(int irq, void *dev_id)
 {
-	int loop_cntr = 10000;
+	u32 status = at91_twi_read(AT91_TWI_SR) & at91_twi_read(AT91_TWI_IMR);
+
+	if (!status)
+		return IRQ_NONE;
+
+	if (status & (AT91_TWI_NACK | AT91_TWI_ARBLST)) {
+		/* the transfer has ended, TXCOMP is set as well */
+		if (twi_pdc_active)
+			at91_twi_write(ATMEL_PDC_PTCR,
+				       ATMEL_PDC_RXTDIS | ATMEL_PDC_TXTDIS);
+		at91_twi_write(AT91_TWI_IDR, 0xffffffff);
+		twi_error = (status & AT91_TWI_NACK) ? -EREMOTEIO : -EAGAIN;
+		complete(&twi_done);
+		return IRQ_HANDLED;
+	}
 
-	do {
-		udelay(10);
-	} while (!(at91_twi_read(AT91_TWI_SR) & bit) && (--loop_cntr > 0));
+	if (status & AT91_TWI_ENDRX) {
+		/* all but the last byte are in; Stop goes with the last one */
+		at91_twi_write(ATMEL_PDC_PTCR, ATMEL_PDC_RXTDIS);
+		at91_twi_write(AT91_TWI_CR, AT91_TWI_STOP);
+		at91_twi_write(AT91_TWI_IDR, AT91_TWI_ENDRX);
+		at91_twi_write(AT91_TWI_IER, AT91_TWI_RXRDY);
+	}
 
-	return (loop_cntr > 0);
-}
+	if (status & AT91_TWI_ENDTX) {
+		at91_twi_write(ATMEL_PDC_PTCR, ATMEL_PDC_TXTDIS);
+		at91_twi_write(AT91_TWI_IDR, AT91_TWI_ENDTX);
+		at91_twi_write(AT91_TWI_IER, AT91_TWI_TXRDY);
+	}
 
-static int xfer_read(struct i2c_adapter *adap, unsigned char *buf, int length)
-{
-	/* Send Start */
-	at91_twi_write(AT91_TWI_CR, AT91_TWI_START);
+	if (status & AT91_TWI_RXRDY) {
+		*twi_buf++ = at91_twi_read(AT91_TWI_RHR) & 0xff;
+		if (--twi_len == 1)	/* send Stop before the last byte */
+			at91_twi_write(AT91_TWI_CR, AT91_TWI_STOP);
+		if (twi_len == 0) {
+			at91_twi_write(AT91_TWI_IDR, AT91_TWI_RXRDY);
+			at91_twi_write(AT91_TWI_IER, AT91_TWI_TXCOMP);
+		}
+	}
 
-	/* Read data */
-	while (length--) {
-		if (!length)	/* need to send Stop before reading last byte */
+	if (status & AT91_TWI_TXRDY) {
+		if (twi_len > 0) {
+			at91_twi_write(AT91_TWI_THR, *twi_buf++);
+			twi_len--;
+		} else {
+			/* last byte is on the wire */
+			at91_twi_write(AT91_TWI_IDR, AT91_TWI_TXRDY);
 			at91_twi_write(AT91_TWI_CR, AT91_TWI_STOP);
-		if (!at91_poll_status(AT91_TWI_RXRDY)) {
-			dev_dbg(&adap->dev, "RXRDY timeout\n");
-			return -ETIMEDOUT;
+			at91_twi_write(AT91_TWI_IER, AT91_TWI_TXCOMP);
 		}
-		*buf++ = (at91_twi_read(AT91_TWI_RHR) & 0xff);
 	}
 
-	return 0;
+	if (status & AT91_TWI_TXCOMP) {
+		at91_twi_write(AT91_TWI_IDR, 0xffffffff);
+		complete(&twi_done);
+	}
+
+	return IRQ_HANDLED;
 }
 
-static int xfer_write(struct i2c_adapter *adap, unsigned char *buf, int length)
+static void xfer_read(unsigned char *buf, int length)
 {
+	twi_buf = buf;
+	twi_len = length;
+
+	if (twi_pdc_active) {
+		/* PDC takes all but the last byte, see at91_twi_interrupt() */
+		twi_buf += length - 1;
+		twi_len = 1;
+		at91_twi_write(ATMEL_PDC_RPR, twi_pdc_dma);
+		at91_twi_write(ATMEL_PDC_RCR, length - 1);
+		at91_twi_write(ATMEL_PDC_PTCR, ATMEL_PDC_RXTEN);
+		at91_twi_write(AT91_TWI_CR, AT91_TWI_START);
+		at91_twi_write(AT91_TWI_IER, AT91_TWI_ENDRX | AT91_TWI_NACK);
+		return;
+	}
+
+	/* Send Start, and Stop right away for a single byte */
+	if (length == 1)
+		at91_twi_write(AT91_TWI_CR, AT91_TWI_START | AT91_TWI_STOP);
+	else
+		at91_twi_write(AT91_TWI_CR, AT91_TWI_START);
+	at91_twi_write(AT91_TWI_IER, AT91_TWI_RXRDY | AT91_TWI_NACK);
+}
+
+static void xfer_write(unsigned char *buf, int length)
+{
+	if (twi_pdc_active) {
+		twi_len = 0;
+		at91_twi_write(ATMEL_PDC_TPR, twi_pdc_dma);
+		at91_twi_write(ATMEL_PDC_TCR, length);
+		at91_twi_write(ATMEL_PDC_PTCR, ATMEL_PDC_TXTEN);
+		at91_twi_write(AT91_TWI_CR, AT91_TWI_START);
+		at91_twi_write(AT91_TWI_IER, AT91_TWI_ENDTX | AT91_TWI_NACK);
+		return;
+	}
+
 	/* Load first byte into transmitter */
 	at91_twi_write(AT91_TWI_THR, *buf++);
+	twi_buf = buf;
+	twi_len = length - 1;
 
 	/* Send Start */
 	at91_twi_write(AT91_TWI_CR, AT91_TWI_START);
+	at91_twi_write(AT91_TWI_IER, AT91_TWI_TXRDY | AT91_TWI_NACK);
+}
 
-	do {
-		if (!at91_poll_status(AT91_TWI_TXRDY)) {
-			dev_dbg(&adap->dev, "TXRDY timeout\n");
-			return -ETIMEDOUT;
-		}
-
-		length--;	/* byte was transmitted */
+/*
+ * Transfer one message and sleep until the interrupt handler is done.
+ */
+static int at91_xfer_msg(struct i2c_adapter *adap, struct i2c_msg *pmsg)
+{
+	int is_read = pmsg->flags & I2C_M_RD;
+
+	twi_error = 0;
+	twi_pdc_active = twi_has_pdc && pmsg->len >= TWI_PDC_MIN
+		&& pmsg->len <= TWI_PDC_BUFSIZE;
+	if (twi_pdc_active && !is_read)
+		memcpy(twi_pdc_buf, pmsg->buf, pmsg->len);
+
+	INIT_COMPLETION(twi_done);
+
+	if (is_read)
+		xfer_read(pmsg->buf, pmsg->len);
+	else
+		xfer_write(pmsg->buf, pmsg->len);
+
+	if (!wait_for_completion_timeout(&twi_done, adap->timeout)) {
+		dev_dbg(&adap->dev, "transfer timeout\n");
+		at91_twi_write(AT91_TWI_IDR, 0xffffffff);
+		if (twi_has_pdc)
+			at91_twi_write(ATMEL_PDC_PTCR,
+				       ATMEL_PDC_RXTDIS | ATMEL_PDC_TXTDIS);
+		at91_twi_hwinit();
+		return -ETIMEDOUT;
+	}
 
-		if (length > 0)		/* more data to send? */
-			at91_twi_write(AT91_TWI_THR, *buf++);
-	} while (length);
+	if (twi_error) {
+		dev_dbg(&adap->dev, "transfer failed (%d)\n", twi_error);
+		return twi_error;
+	}
 
-	/* Send Stop */
-	at91_twi_write(AT91_TWI_CR, AT91_TWI_STOP);
+	if (twi_pdc_active && is_read)
+		memcpy(pmsg->buf, twi_pdc_buf, pmsg->len - 1);
 
 	return 0;
 }
@@ -158,19 +277,9 @@ static int at91_xfer(struct i2c_adapter *adap, struct i2c_msg *pmsg, int num)
 			| ((pmsg->flags & I2C_M_RD) ? AT91_TWI_MREAD : 0));
 
 		if (pmsg->len && pmsg->buf) {	/* sanity check */
-			if (pmsg->flags & I2C_M_RD)
-				ret = xfer_read(adap, pmsg->buf, pmsg->len);
-			else
-				ret = xfer_write(adap, pmsg->buf, pmsg->len);
-
+			ret = at91_xfer_msg(adap, pmsg);
 			if (ret)
 				return ret;
-
-			/* Wait until transfer is finished */
-			if (!at91_poll_status(AT91_TWI_TXCOMP)) {
-				dev_dbg(&adap->dev, "TXCOMP timeout\n");
-				return -ETIMEDOUT;
-			}
 		}
 		dev_dbg(&adap->dev, "transfer complete\n");
 		pmsg++;		/* next message */
@@ -230,23 +339,45 @@ static int __devinit at91_i2c_probe(struct platform_device *pdev)
 	adapter->algo = &at91_algorithm;
 	adapter->class = I2C_CLASS_HWMON;
 	adapter->dev.parent = &pdev->dev;
+	adapter->timeout = HZ;
 
 	platform_set_drvdata(pdev, adapter);
 
 	clk_enable(twi_clk);		/* enable peripheral clock */
 	at91_twi_hwinit();		/* initialize TWI controller */
 
+	twi_has_pdc = cpu_is_at91sam9rl() || cpu_is_at91sam9g45();
+	if (twi_has_pdc) {
+		twi_pdc_buf = dma_alloc_coherent(&pdev->dev, TWI_PDC_BUFSIZE,
+						 &twi_pdc_dma, GFP_KERNEL);
+		if (!twi_pdc_buf)
+			twi_has_pdc = 0;	/* interrupt-driven PIO only */
+	}
+
+	twi_irq = platform_get_irq(pdev, 0);
+	rc = request_irq(twi_irq, at91_twi_interrupt, 0, "at91_i2c", NULL);
+	if (rc) {
+		dev_err(&pdev->dev, "can't get irq %d\n", twi_irq);
+		goto fail3;
+	}
+
 	rc = i2c_add_numbered_adapter(adapter);
 	if (rc) {
 		dev_err(&pdev->dev, "Adapter %s registration failed\n",
 				adapter->name);
-		goto fail3;
+		goto fail4;
 	}
 
-	dev_info(&pdev->dev, "AT91 i2c bus driver.\n");
+	dev_info(&pdev->dev, "AT91 i2c bus driver%s.\n",
+		 twi_has_pdc ? " (PDC)" : "");
 	return 0;
 
+fail4:
+	free_irq(twi_irq, NULL);
 fail3:
+	if (twi_has_pdc)
+		dma_free_coherent(&pdev->dev, TWI_PDC_BUFSIZE, twi_pdc_buf,
+				  twi_pdc_dma);
 	platform_set_drvdata(pdev, NULL);
 	kfree(adapter);
 	clk_disable(twi_clk);
@@ -269,6 +400,11 @@ static int __devexit at91_i2c_remove(struct platform_device *pdev)
 	rc = i2c_del_adapter(adapter);
 	platform_set_drvdata(pdev, NULL);
 
+	free_irq(twi_irq, NULL);
+	if (twi_has_pdc)
+		dma_free_coherent(&pdev->dev, TWI_PDC_BUFSIZE, twi_pdc_buf,
+				  twi_pdc_dma);
+
 	res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
 	iounmap(twi_base);
 	release_mem_region(res->start, res->end - res->start + 1);
@@ -13,6 +13,7 @@
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
 #include <linux/delay.h>
 #include <linux/mutex.h>
 #include <linux/sysfs.h>
@@ -20,6 +21,7 @@
 #include <linux/log2.h>
 #include <linux/bitops.h>
 #include <linux/jiffies.h>
+#include <linux/workqueue.h>
 #include <linux/i2c.h>
 #include <linux/i2c/at24.h>
 
@@ -49,6 +51,13 @@
  * that this one handles write access and isn't restricted to 24c02 devices.
  * It also handles larger devices (32 kbit and up) with two-byte addresses,
  * which won't work on pure SMBus systems.
+ *
+ * Boards can set AT24_FLAG_CACHED to keep a shadow copy of the whole chip
+ * in RAM. Reads are then served from the shadow once it has been loaded,
+ * and writes only mark the affected pages dirty; a delayed work item
+ * writes each dirty page back with one page write, so a burst of small
+ * updates costs one write cycle per page. The "eeprom_sync" attribute and
+ * memory_accessor sync() force the write-back and report its status.
  */
 
 struct at24_data {
@@ -67,6 +76,14 @@ struct at24_data {
 	unsigned write_max;
 	unsigned num_addresses;
 
+	/* shadow of the chip contents, AT24_FLAG_CACHED only */
+	u8 *shadow;
+	bool shadow_valid;
+	unsigned long *dirty;		/* one bit per page */
+	unsigned num_pages;
+	int wb_error;			/* last write-back failure */
+	struct delayed_work wb_work;
+
 	/*
 	 * Some chips tie up multiple I2C addresses; dummy devices reserve
 	 * them for us, and we'll use them with SMBus calls.
@@ -95,6 +112,15 @@ static unsigned write_timeout = 25;
 module_param(write_timeout, uint, 0);
 MODULE_PARM_DESC(write_timeout, "Time (in ms) to try writes (default 25)");
 
+/*
+ * With AT24_FLAG_CACHED, dirty pages are written back this long after the
+ * first write that dirtied them, so later writes can join the same cycle.
+ */
+static unsigned writeback_delay = 100;
+module_param(writeback_delay, uint, 0644);
+MODULE_PARM_DESC(writeback_delay,
+		"Delay (in ms) before cached writes reach the chip (default 100)");
+
 #define AT24_SIZE_BYTELEN 5
 #define AT24_SIZE_FLAGS 8
 
@@ -226,20 +252,11 @@ static ssize_t at24_eeprom_read(struct at24_data *at24, char *buf,
 		return status;
 }
 
-static ssize_t at24_read(struct at24_data *at24,
+static ssize_t at24_read_chip(struct at24_data *at24,
 		char *buf, loff_t off, size_t count)
 {
 	ssize_t retval = 0;
 
-	if (unlikely(!count))
-		return count;
-
-	/*
-	 * Read data from chip, protecting against concurrent updates
-	 * from this host, but not from other I2C masters.
-	 */
-	mutex_lock(&at24->lock);
-
 	while (count) {
 		ssize_t	status;
 
@@ -255,6 +272,38 @@ static ssize_t at24_read(struct at24_data *at24,
 		retval += status;
 	}
 
+	return retval;
+}
+
+static int at24_cache_fill(struct at24_data *at24);
+
+static ssize_t at24_read(struct at24_data *at24,
+		char *buf, loff_t off, size_t count)
+{
+	ssize_t retval;
+
+	if (unlikely(!count))
+		return count;
+
+	/*
+	 * Read data from chip, protecting against concurrent updates
+	 * from this host, but not from other I2C masters.
+	 */
+	mutex_lock(&at24->lock);
+
+	if (at24->shadow) {
+		if (off >= at24->chip.byte_len)
+			count = 0;
+		else if (count > at24->chip.byte_len - off)
+			count = at24->chip.byte_len - off;
+		retval = at24_cache_fill(at24);
+		if (retval == 0) {
+			memcpy(buf, at24->shadow + off, count);
+			retval = count;
+		}
+	} else
+		retval = at24_read_chip(at24, buf, off, count);
+
 	mutex_unlock(&at24->lock);
 
 	return retval;
@@ -347,20 +396,11 @@ static ssize_t at24_eeprom_write(struct at24_data *at24, const char *buf,
 	return -ETIMEDOUT;
 }
 
-static ssize_t at24_write(struct at24_data *at24, const char *buf, loff_t off,
-			  size_t count)
+static ssize_t at24_write_chip(struct at24_data *at24, const char *buf,
+		loff_t off, size_t count)
 {
 	ssize_t retval = 0;
 
-	if (unlikely(!count))
-		return count;
-
-	/*
-	 * Write data to chip, protecting against concurrent updates
-	 * from this host, but not from other I2C masters.
-	 */
-	mutex_lock(&at24->lock);
-
 	while (count) {
 		ssize_t	status;
 
@@ -376,6 +416,157 @@ static ssize_t at24_write(struct at24_data *at24, const char *buf, loff_t off,
 		retval += status;
 	}
 
+	return retval;
+}
+
+/*-------------------------------------------------------------------------*/
+
+/*
+ * Shadow cache. All of these are called with at24->lock held.
+ */
+
+/* Load the whole chip into the shadow, once */
+static int at24_cache_fill(struct at24_data *at24)
+{
+	ssize_t status;
+
+	if (at24->shadow_valid)
+		return 0;
+
+	status = at24_read_chip(at24, at24->shadow, 0, at24->chip.byte_len);
+	if (status < 0)
+		return status;
+	if (status != at24->chip.byte_len)
+		return -EIO;
+
+	at24->shadow_valid = true;
+	return 0;
+}
+
+/* Write every dirty page back to the chip, one page write each */
+static int at24_cache_writeback(struct at24_data *at24)
+{
+	unsigned page_size = at24->chip.page_size;
+	unsigned page;
+	int err = 0;
+
+	for (page = find_first_bit(at24->dirty, at24->num_pages);
+	     page < at24->num_pages;
+	     page = find_next_bit(at24->dirty, at24->num_pages, page + 1)) {
+		unsigned off = page * page_size;
+		size_t len = min(page_size, at24->chip.byte_len - off);
+		ssize_t status;
+
+		status = at24_write_chip(at24, at24->shadow + off, off, len);
+		if (status != len) {
+			/* keep the page dirty, try again on the next sync */
+			err = status < 0 ? status : -EIO;
+			continue;
+		}
+		clear_bit(page, at24->dirty);
+	}
+
+	return err;
+}
+
+static void at24_cache_work(struct work_struct *work)
+{
+	struct at24_data *at24 =
+		container_of(work, struct at24_data, wb_work.work);
+	int err;
+
+	mutex_lock(&at24->lock);
+	err = at24_cache_writeback(at24);
+	if (err) {
+		at24->wb_error = err;
+		dev_err(&at24->client[0]->dev, "write-back failed (%d)\n", err);
+	}
+	mutex_unlock(&at24->lock);
+}
+
+/*
+ * Update the shadow and mark the pages whose contents changed as dirty.
+ * Rewriting bytes with the value they already have costs nothing.
+ */
+static ssize_t at24_cache_write(struct at24_data *at24, const char *buf,
+		loff_t off, size_t count)
+{
+	unsigned page_size = at24->chip.page_size;
+	size_t done = 0;
+	bool dirtied = false;
+	int err;
+
+	if (off >= at24->chip.byte_len)
+		return -EFBIG;
+	if (count > at24->chip.byte_len - off)
+		count = at24->chip.byte_len - off;
+
+	err = at24_cache_fill(at24);
+	if (err)
+		return err;
+
+	while (done < count) {
+		unsigned page = (off + done) / page_size;
+		size_t len = min_t(size_t, count - done,
+				   (page + 1) * page_size - (off + done));
+
+		if (memcmp(at24->shadow + off + done, buf + done, len)) {
+			memcpy(at24->shadow + off + done, buf + done, len);
+			set_bit(page, at24->dirty);
+			dirtied = true;
+		}
+		done += len;
+	}
+
+	if (dirtied)
+		schedule_delayed_work(&at24->wb_work,
+				      msecs_to_jiffies(writeback_delay));
+
+	return count;
+}
+
+/*
+ * Flush the shadow to the chip and report any write-back failure since
+ * the last sync, like fsync() does.
+ */
+static int at24_sync(struct at24_data *at24)
+{
+	int err;
+
+	if (!at24->shadow)
+		return 0;
+
+	cancel_delayed_work_sync(&at24->wb_work);
+
+	mutex_lock(&at24->lock);
+	err = at24_cache_writeback(at24);
+	if (!err)
+		err = at24->wb_error;
+	at24->wb_error = 0;
+	mutex_unlock(&at24->lock);
+
+	return err;
+}
+
+static ssize_t at24_write(struct at24_data *at24, const char *buf, loff_t off,
+			  size_t count)
+{
+	ssize_t retval;
+
+	if (unlikely(!count))
+		return count;
+
+	/*
+	 * Write data to chip, protecting against concurrent updates
+	 * from this host, but not from other I2C masters.
+	 */
+	mutex_lock(&at24->lock);
+
+	if (at24->shadow)
+		retval = at24_cache_write(at24, buf, off, count);
+	else
+		retval = at24_write_chip(at24, buf, off, count);
+
 	mutex_unlock(&at24->lock);
 
 	return retval;
@@ -390,6 +581,22 @@ static ssize_t at24_bin_write(struct kobject *kobj, struct bin_attribute *attr,
 	return at24_write(at24, buf, off, count);
 }
 
+/*
+ * Writing anything to "eeprom_sync" flushes cached writes to the chip;
+ * the write fails if the data could not be written back.
+ */
+static ssize_t at24_sync_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct at24_data *at24 = dev_get_drvdata(dev);
+	int err;
+
+	err = at24_sync(at24);
+	return err ? err : count;
+}
+
+static DEVICE_ATTR(eeprom_sync, S_IWUSR, NULL, at24_sync_store);
+
 /*-------------------------------------------------------------------------*/
 
 /*
@@ -414,6 +621,13 @@ static ssize_t at24_macc_write(struct memory_accessor *macc, const char *buf,
 	return at24_write(at24, buf, offset, count);
 }
 
+static int at24_macc_sync(struct memory_accessor *macc)
+{
+	struct at24_data *at24 = container_of(macc, struct at24_data, macc);
+
+	return at24_sync(at24);
+}
+
 /*-------------------------------------------------------------------------*/
 
 static int at24_probe(struct i2c_client *client, const struct i2c_device_id *id)
@@ -506,6 +720,7 @@ static int at24_probe(struct i2c_client *client, const struct i2c_device_id *id)
 			unsigned write_max = chip.page_size;
 
 			at24->macc.write = at24_macc_write;
+			at24->macc.sync = at24_macc_sync;
 
 			at24->bin.write = at24_bin_write;
 			at24->bin.attr.mode |= S_IWUSR;
@@ -528,6 +743,22 @@ static int at24_probe(struct i2c_client *client, const struct i2c_device_id *id)
 		}
 	}
 
+	if (chip.flags & AT24_FLAG_CACHED) {
+		if (!chip.page_size) {
+			err = -EINVAL;
+			goto err_struct;
+		}
+		at24->num_pages = DIV_ROUND_UP(chip.byte_len, chip.page_size);
+		at24->dirty = kzalloc(BITS_TO_LONGS(at24->num_pages) *
+				sizeof(long), GFP_KERNEL);
+		at24->shadow = vmalloc(chip.byte_len);
+		if (!at24->dirty || !at24->shadow) {
+			err = -ENOMEM;
+			goto err_struct;
+		}
+		INIT_DELAYED_WORK(&at24->wb_work, at24_cache_work);
+	}
+
 	at24->client[0] = client;
 
 	/* use dummy devices for multiple-address chips */
@@ -546,11 +777,18 @@ static int at24_probe(struct i2c_client *client, const struct i2c_device_id *id)
 	if (err)
 		goto err_clients;
 
+	if (at24->shadow && at24->macc.write) {
+		err = device_create_file(&client->dev, &dev_attr_eeprom_sync);
+		if (err)
+			goto err_bin;
+	}
+
 	i2c_set_clientdata(client, at24);
 
-	dev_info(&client->dev, "%zu byte %s EEPROM %s\n",
+	dev_info(&client->dev, "%zu byte %s EEPROM %s%s\n",
 		at24->bin.size, client->name,
-		writable ? "(writable)" : "(read-only)");
+		writable ? "(writable)" : "(read-only)",
+		at24->shadow ? ", cached" : "");
 	dev_dbg(&client->dev,
 		"page_size %d, num_addresses %d, write_max %d%s\n",
 		chip.page_size, num_addresses,
@@ -563,13 +801,17 @@ static int at24_probe(struct i2c_client *client, const struct i2c_device_id *id)
 
 	return 0;
 
+err_bin:
+	sysfs_remove_bin_file(&client->dev.kobj, &at24->bin);
 err_clients:
 	for (i = 1; i < num_addresses; i++)
 		if (at24->client[i])
 			i2c_unregister_device(at24->client[i]);
 
-	kfree(at24->writebuf);
 err_struct:
+	vfree(at24->shadow);
+	kfree(at24->dirty);
+	kfree(at24->writebuf);
 	kfree(at24);
 err_out:
 	dev_dbg(&client->dev, "probe error %d\n", err);
@@ -584,15 +826,34 @@ static int __devexit at24_remove(struct i2c_client *client)
 	at24 = i2c_get_clientdata(client);
 	sysfs_remove_bin_file(&client->dev.kobj, &at24->bin);
 
+	/* don't lose cached writes */
+	if (at24->shadow) {
+		if (at24->macc.write)
+			device_remove_file(&client->dev, &dev_attr_eeprom_sync);
+		if (at24_sync(at24))
+			dev_err(&client->dev, "cached writes lost\n");
+	}
+
 	for (i = 1; i < at24->num_addresses; i++)
 		i2c_unregister_device(at24->client[i]);
 
+	vfree(at24->shadow);
+	kfree(at24->dirty);
 	kfree(at24->writebuf);
 	kfree(at24);
 	i2c_set_clientdata(client, NULL);
 	return 0;
 }
 
+/* reboot and poweroff don't call remove; write cached data back here */
+static void at24_shutdown(struct i2c_client *client)
+{
+	struct at24_data *at24 = i2c_get_clientdata(client);
+
+	if (at24 && at24->shadow && at24_sync(at24))
+		dev_err(&client->dev, "cached writes lost\n");
+}
+
 /*-------------------------------------------------------------------------*/
 
 static struct i2c_driver at24_driver = {
@@ -602,6 +863,7 @@ static struct i2c_driver at24_driver = {
 	},
 	.probe = at24_probe,
 	.remove = __devexit_p(at24_remove),
+	.shutdown = at24_shutdown,
 	.id_table = at24_ids,
 };
 
@@ -49,6 +49,15 @@
 
      The sequence of write interrupts is: ENDTX, TXBUFE, NOTBUSY, CMDRDY
 
+     SCATTER-GATHER MODE
+     On the AT91SAM926x the whole scatterlist is instead mapped with
+     dma_map_sg() and both directions go straight to/from the request pages.
+     The PDC current and next pointer pairs are both kept loaded; every ENDRX
+     or ENDTX reloads the next pair, so consecutive segments stream without
+     a gap and without copying. Requests that don't suit it (odd block or
+     segment sizes, the short write erratum) use the paths above. It can be
+     turned off with the "sg_dma" module parameter.
+
    GET RO
      Gets the status of the write protect pin, if available.
 */
@@ -79,6 +88,15 @@
 
 #define DRIVER_NAME "at91_mci"
 
+static int sg_dma = 1;
+module_param(sg_dma, bool, 0444);
+MODULE_PARM_DESC(sg_dma, "Map requests directly and chain PDC segments (default 1)");
+
+/* Limits in scatter-gather mode; the PDC counts up to 65535 words */
+#define AT91_MCI_SG_SEGS	32
+#define AT91_MCI_SG_SEG_SIZE	65536
+#define AT91_MCI_SG_REQ_SIZE	(64 * 1024)
+
 static inline int at91mci_is_mci1rev2xx(void)
 {
 	return (   cpu_is_at91sam9260()
@@ -137,6 +155,10 @@ struct at91mci_host
 	/* Latest in the scatterlist that has been enabled for transfer */
 	int transfer_index;
 
+	/* Scatter-gather mode: mapped entries, bytes still to hand to the PDC */
+	int sg_count;
+	unsigned int sg_remain;
+
 	/* Timer for timeouts */
 	struct timer_list timer;
 };
@@ -178,6 +200,8 @@ static void at91_reset_host(struct at91mci_host *host)
 	local_irq_restore(flags);
 }
 
+static void at91_mci_sg_unmap(struct at91mci_host *host, struct mmc_data *data);
+
 static void at91_timeout_timer(unsigned long data)
 {
 	struct at91mci_host *host;
@@ -197,6 +221,8 @@ static void at91_timeout_timer(unsigned long data)
 		}
 
 		at91_reset_host(host);
+		if (host->cmd && host->cmd->data)
+			at91_mci_sg_unmap(host, host->cmd->data);
 		mmc_request_done(host->mmc, host->request);
 	}
 }
@@ -256,6 +282,102 @@ static inline void at91_mci_sg_to_dma(struct at91mci_host *host, struct mmc_data
 	BUG_ON(size != 0);
 }
 
+/*
+ * Can this data transfer go directly to/from the scatterlist?
+ */
+static int at91_mci_use_sg(struct at91mci_host *host, struct mmc_data *data)
+{
+	struct scatterlist *sg;
+	int i;
+
+	/* AT91RM9200 needs the data byte swapped, see at91_mci_sg_to_dma() */
+	if (!sg_dma || cpu_is_at91rm9200())
+		return 0;
+
+	if (data->blksz & 0x3)
+		return 0;
+
+	/* at91mci MCI1 rev2xx Data Write Operation and number of bytes erratum */
+	if (at91mci_is_mci1rev2xx() && (data->flags & MMC_DATA_WRITE)
+			&& data->blksz * data->blocks < 12)
+		return 0;
+
+	for_each_sg(data->sg, sg, data->sg_len, i)
+		if ((sg->offset | sg->length) & 0x3)
+			return 0;
+
+	return 1;
+}
+
+/*
+ * Load the PDC current and next pointer pairs with the next mapped
+ * segments, whichever of them is free. Returns the number of segments
+ * that still have to be loaded afterwards.
+ */
+static int at91_mci_sg_load(struct at91mci_host *host, int write)
+{
+	struct mmc_data *data = host->cmd->data;
+	unsigned int ptr = write ? ATMEL_PDC_TPR : ATMEL_PDC_RPR;
+	unsigned int cnt = write ? ATMEL_PDC_TCR : ATMEL_PDC_RCR;
+	unsigned int nptr = write ? ATMEL_PDC_TNPR : ATMEL_PDC_RNPR;
+	unsigned int ncnt = write ? ATMEL_PDC_TNCR : ATMEL_PDC_RNCR;
+
+	while (host->sg_remain && host->transfer_index < host->sg_count) {
+		struct scatterlist *sg = &data->sg[host->transfer_index];
+		unsigned int len = min(sg_dma_len(sg), host->sg_remain);
+
+		if (at91_mci_read(host, cnt) == 0) {
+			at91_mci_write(host, ptr, sg_dma_address(sg));
+			at91_mci_write(host, cnt, len / 4);
+		} else if (at91_mci_read(host, ncnt) == 0) {
+			at91_mci_write(host, nptr, sg_dma_address(sg));
+			at91_mci_write(host, ncnt, len / 4);
+		} else
+			break;
+
+		pr_debug("sg %d: %08X, %d bytes\n", host->transfer_index,
+			sg_dma_address(sg), len);
+
+		host->transfer_index++;
+		host->sg_remain -= len;
+	}
+
+	return host->sg_remain ? host->sg_count - host->transfer_index : 0;
+}
+
+/*
+ * PDC finished a segment: refill, and wait for the whole buffer to drain
+ * once everything has been loaded. Returns the interrupt to keep enabled.
+ */
+static unsigned int at91_mci_sg_next(struct at91mci_host *host, int write)
+{
+	if (!host->cmd || !host->cmd->data || !host->sg_count)
+		return 0;
+
+	if (at91_mci_sg_load(host, write))
+		return write ? AT91_MCI_ENDTX : AT91_MCI_ENDRX;
+
+	at91_mci_write(host, AT91_MCI_IER, write ? AT91_MCI_TXBUFE : AT91_MCI_RXBUFF);
+	return 0;
+}
+
+static void at91_mci_sg_unmap(struct at91mci_host *host, struct mmc_data *data)
+{
+	int i;
+
+	if (!host->sg_count)
+		return;
+
+	if (data->flags & MMC_DATA_READ) {
+		dma_unmap_sg(mmc_dev(host->mmc), data->sg, data->sg_len, DMA_FROM_DEVICE);
+		for (i = 0; i < data->sg_len; i++)
+			flush_dcache_page(sg_page(&data->sg[i]));
+	} else
+		dma_unmap_sg(mmc_dev(host->mmc), data->sg, data->sg_len, DMA_TO_DEVICE);
+
+	host->sg_count = 0;
+}
+
 /*
  * Prepare a dma read
  */
@@ -452,7 +574,11 @@ static int at91_mci_handle_cmdrdy(struct at91mci_host *host)
 		} else return 1;
 	} else if (host->cmd->data->flags & MMC_DATA_WRITE) {
 		/*After sendding multi-block-write command, start DMA transfer*/
-		at91_mci_write(host, AT91_MCI_IER, AT91_MCI_TXBUFE | AT91_MCI_BLKE);
+		if (host->sg_count && host->transfer_index < host->sg_count
+				&& host->sg_remain)
+			at91_mci_write(host, AT91_MCI_IER, AT91_MCI_ENDTX | AT91_MCI_BLKE);
+		else
+			at91_mci_write(host, AT91_MCI_IER, AT91_MCI_TXBUFE | AT91_MCI_BLKE);
 		at91_mci_write(host, ATMEL_PDC_PTCR, ATMEL_PDC_TXTEN);
 	}
 
@@ -606,11 +732,39 @@ static void at91_mci_send_command(struct at91mci_host *host, struct mmc_command
 		 */
 		at91_mci_write(host, ATMEL_PDC_PTCR, ATMEL_PDC_RXTDIS | ATMEL_PDC_TXTDIS);
 
+		/*
+		 * An aborted transfer can leave counts behind; the loaders
+		 * below pick free slots by looking at them.
+		 */
+		at91_mci_write(host, ATMEL_PDC_RCR, 0);
+		at91_mci_write(host, ATMEL_PDC_RNCR, 0);
+		at91_mci_write(host, ATMEL_PDC_TCR, 0);
+		at91_mci_write(host, ATMEL_PDC_TNCR, 0);
+
 		if (cmdr & AT91_MCI_TRCMD_START) {
 			data->bytes_xfered = 0;
 			host->transfer_index = 0;
 			host->in_use_index = 0;
-			if (cmdr & AT91_MCI_TRDIR) {
+			host->sg_count = 0;
+			if (at91_mci_use_sg(host, data)) {
+				int write = data->flags & MMC_DATA_WRITE;
+				int more;
+
+				host->buffer = NULL;
+				host->total_length = block_length * blocks;
+				host->sg_remain = host->total_length;
+				host->sg_count = dma_map_sg(mmc_dev(host->mmc),
+						data->sg, data->sg_len, write ?
+						DMA_TO_DEVICE : DMA_FROM_DEVICE);
+
+				/* writes enable the PDC on CMDRDY */
+				more = at91_mci_sg_load(host, write);
+				if (write)
+					ier = AT91_MCI_CMDRDY;
+				else
+					ier = more ? AT91_MCI_ENDRX : AT91_MCI_RXBUFF;
+			}
+			else if (cmdr & AT91_MCI_TRDIR) {
 				/*
 				 * Handle a read
 				 */
@@ -720,6 +874,9 @@ static void at91_mci_completed_command(struct at91mci_host *host, unsigned int s
 		host->buffer = NULL;
 	}
 
+	if (data)
+		at91_mci_sg_unmap(host, data);
+
 	pr_debug("Status = %08X/%08x [%08X %08X %08X %08X]\n",
 		 status, at91_mci_read(host, AT91_MCI_SR),
 		 cmd->resp[0], cmd->resp[1], cmd->resp[2], cmd->resp[3]);
@@ -835,6 +992,7 @@ static irqreturn_t at91_mci_irq(int irq, void *devid)
 	struct at91mci_host *host = devid;
 	int completed = 0;
 	unsigned int int_status, int_mask;
+	unsigned int keep = 0;
 
 	int_status = at91_mci_read(host, AT91_MCI_SR);
 	int_mask = at91_mci_read(host, AT91_MCI_IMR);
@@ -875,18 +1033,30 @@ static irqreturn_t at91_mci_irq(int irq, void *devid)
 
 		if (int_status & AT91_MCI_ENDRX) {
 			pr_debug("ENDRX\n");
-			at91_mci_post_dma_read(host);
+			if (host->sg_count)
+				keep |= at91_mci_sg_next(host, 0);
+			else {
+				at91_mci_post_dma_read(host);
+				/* more segments for the next ENDRX */
+				if (host->cmd && host->cmd->data
+				    && host->transfer_index < host->cmd->data->sg_len)
+					keep |= AT91_MCI_ENDRX;
+			}
 		}
 
 		if (int_status & AT91_MCI_RXBUFF) {
 			pr_debug("RX buffer full\n");
 			at91_mci_write(host, ATMEL_PDC_PTCR, ATMEL_PDC_RXTDIS | ATMEL_PDC_TXTDIS);
 			at91_mci_write(host, AT91_MCI_IDR, AT91_MCI_RXBUFF | AT91_MCI_ENDRX);
+			if (host->sg_count)
+				host->cmd->data->bytes_xfered = host->total_length;
 			completed = 1;
 		}
 
-		if (int_status & AT91_MCI_ENDTX)
+		if (int_status & AT91_MCI_ENDTX) {
 			pr_debug("Transmit has ended\n");
+			keep |= at91_mci_sg_next(host, 1);
+		}
 
 		if (int_status & AT91_MCI_NOTBUSY) {
 			pr_debug("Card is ready\n");
@@ -931,7 +1101,7 @@ static irqreturn_t at91_mci_irq(int irq, void *devid)
 		at91_mci_write(host, AT91_MCI_IDR, 0xffffffff & ~(AT91_MCI_SDIOIRQA | AT91_MCI_SDIOIRQB));
 		at91_mci_completed_command(host, int_status);
 	} else
-		at91_mci_write(host, AT91_MCI_IDR, int_status & ~(AT91_MCI_SDIOIRQA | AT91_MCI_SDIOIRQB));
+		at91_mci_write(host, AT91_MCI_IDR, int_status & ~(AT91_MCI_SDIOIRQA | AT91_MCI_SDIOIRQB | keep));
 
 	return IRQ_HANDLED;
 }
@@ -1020,6 +1190,13 @@ static int __init at91_mci_probe(struct platform_device *pdev)
 	mmc->caps = 0;
 
 	mmc->max_blk_size = 4095;
+	if (sg_dma && !cpu_is_at91rm9200()) {
+		/* let the block layer hand us whole multi-segment requests */
+		mmc->max_hw_segs = AT91_MCI_SG_SEGS;
+		mmc->max_phys_segs = AT91_MCI_SG_SEGS;
+		mmc->max_seg_size = AT91_MCI_SG_SEG_SIZE;
+		mmc->max_req_size = AT91_MCI_SG_REQ_SIZE;
+	}
 	mmc->max_blk_count = mmc->max_req_size;
 
 	host = mmc_priv(mmc);
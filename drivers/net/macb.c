@@ -20,6 +20,9 @@
 #include <linux/dma-mapping.h>
 #include <linux/platform_device.h>
 #include <linux/phy.h>
+#ifdef CONFIG_MACB_COALESCE
+#include <linux/atmel_tc.h>
+#endif
 
 #include <mach/board.h>
 #include <mach/cpu.h>
@@ -33,15 +36,24 @@
 /* Make the IP header word-aligned (the ethernet header is 14 bytes) */
 #define RX_OFFSET		2
 
+/*
+ * With the TX buffers in internal SRAM, the descriptor ring sits at the
+ * start of the SRAM region and the rest is used as a FIFO that frames
+ * are packed into back to back. The ring is sized so that a full ring
+ * of small frames still fits into the SRAM.
+ */
 #if defined(CONFIG_ARCH_AT91) && defined(CONFIG_MACB_TX_SRAM)
 	#if defined(CONFIG_ARCH_AT91SAM9260)
-		#define TX_RING_SIZE       2
-	#elif defined(CONFIG_ARCH_AT91SAM9263)
 		#define TX_RING_SIZE       32
+		#define TX_DMA_SIZE        AT91SAM9260_SRAM0_SIZE
+	#elif defined(CONFIG_ARCH_AT91SAM9263)
+		#define TX_RING_SIZE       128
+		#define TX_DMA_SIZE        (48 * SZ_1K)
 	#endif
 	#define TX_BUFFER_SIZE       1536
 	#define TX_RING_BYTES        (sizeof(struct dma_desc) * TX_RING_SIZE)
-	#define TX_DMA_SIZE      ((TX_RING_BYTES) + (TX_RING_SIZE) * (TX_BUFFER_SIZE))
+	#define TX_SRAM_BYTES        ((TX_DMA_SIZE) - (TX_RING_BYTES))
+	#define TX_SRAM_ALIGN        4
 #else
 	#define TX_RING_SIZE     128
 	#define TX_RING_BYTES        (sizeof(struct dma_desc) * TX_RING_SIZE)
@@ -59,12 +71,59 @@
 
 #define NEXT_RX(n)		(((n) + 1) & (RX_RING_SIZE - 1))
 
+/*
+ * Longest interrupt hold-off. The RX ring holds 64KiB, which takes about
+ * 5ms to fill at 100Mbit/s.
+ */
+#define MACB_COALESCE_MAX_USECS	4000
+
 /* minimum number of free TX descriptors before waking up TX process */
 #define MACB_TX_WAKEUP_THRESH	(TX_RING_SIZE / 4)
 
 #define MACB_RX_INT_FLAGS	(MACB_BIT(RCOMP) | MACB_BIT(RXUBR)	\
 				 | MACB_BIT(ISR_ROVR))
 
+/* Interrupts that are handled by NAPI polling */
+#define MACB_NAPI_INT_FLAGS	(MACB_RX_INT_FLAGS | MACB_BIT(TCOMP))
+
+#if defined(CONFIG_ARCH_AT91) && defined(CONFIG_MACB_TX_SRAM)
+/*
+ * Find room for @size bytes in the SRAM TX FIFO. Frames must be
+ * contiguous, so if there is not enough room before the end of the
+ * FIFO the remainder is skipped and the frame goes to the start.
+ * Returns the offset, or -1 if the frame doesn't fit; *consumed is set
+ * to the number of bytes to account for, including any skipped tail.
+ */
+static int macb_tx_sram_offset(struct macb *bp, unsigned int size,
+			       unsigned int *consumed)
+{
+	unsigned int head = bp->tx_sram_head;
+	unsigned int waste = 0;
+
+	if (head + size > TX_SRAM_BYTES) {
+		waste = TX_SRAM_BYTES - head;
+		head = 0;
+	}
+	if (waste + size > TX_SRAM_BYTES - bp->tx_sram_used)
+		return -1;
+
+	*consumed = waste + size;
+	return head;
+}
+#endif
+
+/* Is there no room left for another full-sized frame? */
+static inline int macb_tx_full(struct macb *bp)
+{
+#if defined(CONFIG_ARCH_AT91) && defined(CONFIG_MACB_TX_SRAM)
+	unsigned int consumed;
+
+	if (macb_tx_sram_offset(bp, TX_BUFFER_SIZE, &consumed) < 0)
+		return 1;
+#endif
+	return TX_BUFFS_AVAIL(bp) < 1;
+}
+
 static void __macb_set_hwaddr(struct macb *bp)
 {
 	u32 bottom;
@@ -316,10 +375,14 @@ static void macb_update_stats(struct macb *bp)
 		*p += __raw_readl(reg);
 }
 
-static void macb_tx(struct macb *bp)
+/*
+ * Clean up transmitted frames. Returns the number of frames completed.
+ */
+static int macb_tx(struct macb *bp)
 {
 	unsigned int tail;
 	unsigned int head;
+	int done = 0;
 	u32 status;
 
 	status = macb_readl(bp, TSR);
@@ -360,6 +423,9 @@ static void macb_tx(struct macb *bp)
 		}
 
 		bp->tx_head = bp->tx_tail = 0;
+#if defined(CONFIG_ARCH_AT91) && defined(CONFIG_MACB_TX_SRAM)
+		bp->tx_sram_head = bp->tx_sram_used = 0;
+#endif
 
 		/* Enable the transmitter again */
 		if (status & MACB_BIT(TGO))
@@ -372,7 +438,7 @@ static void macb_tx(struct macb *bp)
 		 * between reading the ISR and scanning the
 		 * descriptors.  Nothing to worry about.
 		 */
-		return;
+		return 0;
 
 	head = bp->tx_head;
 	for (tail = bp->tx_tail; tail != head; tail = NEXT_TX(tail)) {
@@ -390,7 +456,9 @@ static void macb_tx(struct macb *bp)
 
 		dev_dbg(&bp->pdev->dev, "skb %u (data %p) TX complete\n",
 			tail, skb->data);
-#if !defined(CONFIG_MACB_TX_SRAM)
+#if defined(CONFIG_ARCH_AT91) && defined(CONFIG_MACB_TX_SRAM)
+		bp->tx_sram_used -= rp->sram_len;
+#else
 		dma_unmap_single(&bp->pdev->dev, rp->mapping, skb->len,
 				 DMA_TO_DEVICE);
 #endif
@@ -398,12 +466,179 @@ static void macb_tx(struct macb *bp)
 		bp->stats.tx_bytes += skb->len;
 		rp->skb = NULL;
 		dev_kfree_skb_irq(skb);
+		done++;
 	}
 
 	bp->tx_tail = tail;
+#if defined(CONFIG_ARCH_AT91) && defined(CONFIG_MACB_TX_SRAM)
+	/* Start over at the beginning of the FIFO whenever it runs empty */
+	if (!bp->tx_sram_used)
+		bp->tx_sram_head = 0;
+#endif
 	if (netif_queue_stopped(bp->dev) &&
-	    TX_BUFFS_AVAIL(bp) > MACB_TX_WAKEUP_THRESH)
+	    TX_BUFFS_AVAIL(bp) > MACB_TX_WAKEUP_THRESH && !macb_tx_full(bp))
 		netif_wake_queue(bp->dev);
+
+	return done;
+}
+
+/* Are there transmitted frames waiting to be cleaned up? */
+static inline int macb_tx_done(struct macb *bp)
+{
+	return bp->tx_tail != bp->tx_head
+		&& (bp->tx_ring[bp->tx_tail].ctrl & MACB_BIT(TX_USED));
+}
+
+/*
+ * RX buffers are 128-byte chunks carved out of pages. Frames up to
+ * rx_copybreak bytes are copied into a fresh skb and the buffers are
+ * given back to the hardware in place. For larger frames only the
+ * first buffer (which holds the headers) is copied; the remaining
+ * buffers are attached to the skb as page fragments and the ring
+ * slots are refilled with new chunks.
+ *
+ * Pages that have been completely carved up go into a small pool.
+ * Once the stack has freed every skb referencing such a page, we
+ * hold the only reference left and the page can be carved again
+ * without going through the page allocator.
+ *
+ * rx_copybreak can be changed at runtime through
+ * /sys/module/macb/parameters/rx_copybreak; 1536 copies every frame,
+ * which is handy as a baseline when measuring.
+ */
+static unsigned int rx_copybreak = 256;
+module_param(rx_copybreak, uint, 0644);
+MODULE_PARM_DESC(rx_copybreak,
+		 "Copy received frames up to this size (default 256)");
+
+static struct page *macb_rx_get_page(struct macb *bp, gfp_t gfp)
+{
+	struct page *page;
+	int i;
+
+	for (i = 0; i < MACB_RX_POOL_SIZE; i++) {
+		page = bp->rx_pool[i];
+		if (page && page_count(page) == 1) {
+			bp->rx_pool[i] = NULL;
+			bp->sw_stats.rx_page_reuses++;
+			return page;
+		}
+	}
+
+	page = alloc_page(gfp);
+	if (page)
+		bp->sw_stats.rx_page_allocs++;
+	return page;
+}
+
+static void macb_rx_retire_page(struct macb *bp, struct page *page)
+{
+	unsigned int i = bp->rx_pool_head;
+
+	if (bp->rx_pool[i])
+		put_page(bp->rx_pool[i]);
+	bp->rx_pool[i] = page;
+	bp->rx_pool_head = (i + 1) % MACB_RX_POOL_SIZE;
+}
+
+/*
+ * Make sure the current page and the spare page are present. Together
+ * they hold more chunks than the largest frame can consume, so once
+ * this succeeds macb_rx_map_buf() cannot run out of memory.
+ */
+static int macb_rx_reserve(struct macb *bp, gfp_t gfp)
+{
+	if (!bp->rx_page) {
+		if (bp->rx_spare) {
+			bp->rx_page = bp->rx_spare;
+			bp->rx_spare = NULL;
+		} else {
+			bp->rx_page = macb_rx_get_page(bp, gfp);
+			if (!bp->rx_page)
+				return -ENOMEM;
+		}
+		bp->rx_page_offset = 0;
+	}
+
+	if (!bp->rx_spare) {
+		bp->rx_spare = macb_rx_get_page(bp, gfp);
+		if (!bp->rx_spare)
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+
+/* Put a fresh chunk into ring entry @entry. Needs macb_rx_reserve(). */
+static void macb_rx_map_buf(struct macb *bp, unsigned int entry)
+{
+	struct macb_rx_buf *buf = &bp->rx_buf[entry];
+	struct page *page = bp->rx_page;
+	u32 wrap;
+
+	BUG_ON(!page);
+
+	get_page(page);
+	buf->page = page;
+	buf->offset = bp->rx_page_offset;
+	buf->mapping = dma_map_page(&bp->pdev->dev, page, buf->offset,
+				    RX_BUFFER_SIZE, DMA_FROM_DEVICE);
+
+	bp->rx_page_offset += RX_BUFFER_SIZE;
+	if (bp->rx_page_offset >= PAGE_SIZE) {
+		macb_rx_retire_page(bp, page);
+		bp->rx_page = bp->rx_spare;
+		bp->rx_spare = NULL;
+		bp->rx_page_offset = 0;
+	}
+
+	wrap = bp->rx_ring[entry].addr & MACB_BIT(RX_WRAP);
+	bp->rx_ring[entry].addr = buf->mapping | wrap;
+}
+
+/* Give the buffer in ring entry @entry back to the hardware as is */
+static void macb_rx_reuse_buf(struct macb *bp, unsigned int entry)
+{
+	dma_sync_single_for_device(&bp->pdev->dev, bp->rx_buf[entry].mapping,
+				   RX_BUFFER_SIZE, DMA_FROM_DEVICE);
+	bp->rx_ring[entry].addr &= ~MACB_BIT(RX_USED);
+}
+
+static inline void *macb_rx_buf_addr(struct macb *bp, unsigned int entry)
+{
+	struct macb_rx_buf *buf = &bp->rx_buf[entry];
+
+	dma_sync_single_for_cpu(&bp->pdev->dev, buf->mapping,
+				RX_BUFFER_SIZE, DMA_FROM_DEVICE);
+	return page_address(buf->page) + buf->offset;
+}
+
+static void macb_rx_attach_buf(struct macb *bp, struct sk_buff *skb,
+			       unsigned int entry, unsigned int frag_len)
+{
+	struct macb_rx_buf *buf = &bp->rx_buf[entry];
+	int nr_frags = skb_shinfo(skb)->nr_frags;
+	skb_frag_t *prev = NULL;
+
+	dma_unmap_page(&bp->pdev->dev, buf->mapping, RX_BUFFER_SIZE,
+		       DMA_FROM_DEVICE);
+
+	/* Chunks carved one after another merge into a single fragment */
+	if (nr_frags)
+		prev = &skb_shinfo(skb)->frags[nr_frags - 1];
+	if (prev && prev->page == buf->page
+	    && prev->page_offset + prev->size == buf->offset) {
+		prev->size += frag_len;
+		put_page(buf->page);
+	} else {
+		skb_fill_page_desc(skb, nr_frags, buf->page,
+				   buf->offset, frag_len);
+	}
+	buf->page = NULL;
+
+	skb->len += frag_len;
+	skb->data_len += frag_len;
+	skb->truesize += RX_BUFFER_SIZE;
 }
 
 static int macb_rx_frame(struct macb *bp, unsigned int first_frag,
@@ -412,6 +647,7 @@ static int macb_rx_frame(struct macb *bp, unsigned int first_frag,
 	unsigned int len;
 	unsigned int frag;
 	unsigned int offset = 0;
+	unsigned int copy_len;
 	struct sk_buff *skb;
 
 	len = MACB_BFEXT(RX_FRMLEN, bp->rx_ring[last_frag].ctrl);
@@ -419,11 +655,20 @@ static int macb_rx_frame(struct macb *bp, unsigned int first_frag,
 	dev_dbg(&bp->pdev->dev, "macb_rx_frame frags %u - %u (len %u)\n",
 		first_frag, last_frag, len);
 
-	skb = dev_alloc_skb(len + RX_OFFSET);
+	/*
+	 * Copy the whole frame if it is small, or if we cannot get
+	 * hold of the pages needed to refill the ring.
+	 */
+	copy_len = len;
+	if (len > rx_copybreak && len > RX_BUFFER_SIZE
+	    && !macb_rx_reserve(bp, GFP_ATOMIC))
+		copy_len = RX_BUFFER_SIZE;
+
+	skb = netdev_alloc_skb(bp->dev, copy_len + RX_OFFSET);
 	if (!skb) {
 		bp->stats.rx_dropped++;
 		for (frag = first_frag; ; frag = NEXT_RX(frag)) {
-			bp->rx_ring[frag].addr &= ~MACB_BIT(RX_USED);
+			macb_rx_reuse_buf(bp, frag);
 			if (frag == last_frag)
 				break;
 		}
@@ -433,7 +678,7 @@ static int macb_rx_frame(struct macb *bp, unsigned int first_frag,
 
 	skb_reserve(skb, RX_OFFSET);
 	skb->ip_summed = CHECKSUM_NONE;
-	skb_put(skb, len);
+	skb_put(skb, copy_len);
 
 	for (frag = first_frag; ; frag = NEXT_RX(frag)) {
 		unsigned int frag_len = RX_BUFFER_SIZE;
@@ -442,12 +687,16 @@ static int macb_rx_frame(struct macb *bp, unsigned int first_frag,
 			BUG_ON(frag != last_frag);
 			frag_len = len - offset;
 		}
-		skb_copy_to_linear_data_offset(skb, offset,
-					       (bp->rx_buffers +
-					        (RX_BUFFER_SIZE * frag)),
-					       frag_len);
+		if (offset < copy_len) {
+			skb_copy_to_linear_data_offset(skb, offset,
+						       macb_rx_buf_addr(bp, frag),
+						       frag_len);
+			macb_rx_reuse_buf(bp, frag);
+		} else {
+			macb_rx_attach_buf(bp, skb, frag, frag_len);
+			macb_rx_map_buf(bp, frag);
+		}
 		offset += RX_BUFFER_SIZE;
-		bp->rx_ring[frag].addr &= ~MACB_BIT(RX_USED);
 		wmb();
 
 		if (frag == last_frag)
@@ -472,7 +721,7 @@ static void discard_partial_frame(struct macb *bp, unsigned int begin,
 	unsigned int frag;
 
 	for (frag = begin; frag != end; frag = NEXT_RX(frag))
-		bp->rx_ring[frag].addr &= ~MACB_BIT(RX_USED);
+		macb_rx_reuse_buf(bp, frag);
 	wmb();
 
 	/*
@@ -525,10 +774,129 @@ static int macb_rx(struct macb *bp, int budget)
 	return received;
 }
 
+#ifdef CONFIG_MACB_COALESCE
+/*
+ * Interrupt coalescing. Channel 0 of a TC block is used as a one-shot
+ * hold-off timer: when a poll has handled at least coalesce_frames
+ * frames, the MACB interrupts stay masked and the next poll is
+ * scheduled from the timer interrupt coalesce_usecs later. Polls that
+ * find less work re-enable the interrupts at once, so a lightly loaded
+ * link sees no extra latency.
+ */
+static unsigned int coalesce_tcb = 1;
+module_param(coalesce_tcb, uint, 0444);
+MODULE_PARM_DESC(coalesce_tcb,
+		 "TC block used for interrupt coalescing (default 1)");
+
+static irqreturn_t macb_coalesce_interrupt(int irq, void *dev_id)
+{
+	struct macb *bp = dev_id;
+	u32 sr;
+
+	sr = __raw_readl(bp->tc->regs + ATMEL_TC_REG(0, SR));
+	if (!(sr & ATMEL_TC_CPCS))
+		return IRQ_NONE;
+
+	napi_schedule(&bp->napi);
+
+	return IRQ_HANDLED;
+}
+
+static int macb_coalesce_init(struct macb *bp)
+{
+	struct atmel_tc *tc;
+	void __iomem *regs;
+	int err;
+
+	tc = atmel_tc_alloc(coalesce_tcb, "macb");
+	if (!tc)
+		return -EBUSY;
+	regs = tc->regs;
+
+	err = clk_enable(tc->clk[0]);
+	if (err)
+		goto out_free_tc;
+
+	/* MCK/32, counting up to RC and stopping there */
+	bp->tc_khz = clk_get_rate(tc->clk[0]) / atmel_tc_divisors[2] / 1000;
+	__raw_writel(ATMEL_TC_CLKDIS, regs + ATMEL_TC_REG(0, CCR));
+	__raw_writel(ATMEL_TC_TIMER_CLOCK3 | ATMEL_TC_WAVE
+		     | ATMEL_TC_WAVESEL_UP_AUTO | ATMEL_TC_CPCSTOP,
+		     regs + ATMEL_TC_REG(0, CMR));
+	__raw_writel(~0UL, regs + ATMEL_TC_REG(0, IDR));
+	__raw_readl(regs + ATMEL_TC_REG(0, SR));
+
+	bp->tc = tc;
+	err = request_irq(tc->irq[0], macb_coalesce_interrupt, IRQF_DISABLED,
+			  "macb-coalesce", bp);
+	if (err)
+		goto out_disable_clk;
+
+	__raw_writel(ATMEL_TC_CPCS, regs + ATMEL_TC_REG(0, IER));
+
+	return 0;
+
+out_disable_clk:
+	bp->tc = NULL;
+	clk_disable(tc->clk[0]);
+out_free_tc:
+	atmel_tc_free(tc);
+	return err;
+}
+
+static void macb_coalesce_exit(struct macb *bp)
+{
+	struct atmel_tc *tc = bp->tc;
+
+	if (!tc)
+		return;
+
+	__raw_writel(ATMEL_TC_CLKDIS, tc->regs + ATMEL_TC_REG(0, CCR));
+	__raw_writel(~0UL, tc->regs + ATMEL_TC_REG(0, IDR));
+	free_irq(tc->irq[0], bp);
+	clk_disable(tc->clk[0]);
+	atmel_tc_free(tc);
+	bp->tc = NULL;
+}
+
+/*
+ * Called at the end of a poll that handled @frames frames. Returns 1
+ * if the hold-off timer was started and the interrupts must stay off.
+ */
+static int macb_coalesce_holdoff(struct macb *bp, int frames)
+{
+	u32 ticks;
+
+	if (!bp->tc || !bp->coalesce_usecs || !frames
+	    || frames < bp->coalesce_frames)
+		return 0;
+
+	ticks = bp->coalesce_usecs * bp->tc_khz / 1000;
+	if (ticks < 1)
+		ticks = 1;
+	else if (ticks > 0xffff)
+		ticks = 0xffff;
+
+	__raw_writel(ticks, bp->tc->regs + ATMEL_TC_REG(0, RC));
+	__raw_writel(ATMEL_TC_CLKEN | ATMEL_TC_SWTRG,
+		     bp->tc->regs + ATMEL_TC_REG(0, CCR));
+	bp->sw_stats.coalesce_holdoffs++;
+
+	return 1;
+}
+#else
+static inline int macb_coalesce_init(struct macb *bp) { return -ENODEV; }
+static inline void macb_coalesce_exit(struct macb *bp) { }
+static inline int macb_coalesce_holdoff(struct macb *bp, int frames)
+{
+	return 0;
+}
+#endif
+
 static int macb_poll(struct napi_struct *napi, int budget)
 {
 	struct macb *bp = container_of(napi, struct macb, napi);
-	int work_done;
+	int work_done, tx_done;
 	u32 status;
 
 	status = macb_readl(bp, RSR);
@@ -539,15 +907,36 @@ static int macb_poll(struct napi_struct *napi, int budget)
 	dev_dbg(&bp->pdev->dev, "poll: status = %08lx, budget = %d\n",
 		(unsigned long)status, budget);
 
+	/*
+	 * TX completions are cleaned up here as well, so that a burst of
+	 * transmitted frames costs one interrupt rather than one each.
+	 */
+	bp->sw_stats.napi_polls++;
+
+	spin_lock_irq(&bp->lock);
+	tx_done = macb_tx(bp);
+	spin_unlock_irq(&bp->lock);
+
 	work_done = macb_rx(bp, budget);
-	if (work_done < budget)
+	if (work_done < budget) {
 		napi_complete(napi);
+		if (macb_coalesce_holdoff(bp, work_done + tx_done))
+			return work_done;
+	}
 
 	/*
 	 * We've done what we can to clean the buffers. Make sure we
 	 * get notified when new packets arrive.
 	 */
-	macb_writel(bp, IER, MACB_RX_INT_FLAGS);
+	macb_writel(bp, IER, MACB_NAPI_INT_FLAGS);
+
+	/*
+	 * A TCOMP that was flagged while we were polling may already have
+	 * been read (and cleared) by the interrupt handler. Don't wait for
+	 * the next one if frames were completed in the meantime.
+	 */
+	if (work_done < budget && macb_tx_done(bp) && napi_reschedule(napi))
+		macb_writel(bp, IDR, MACB_NAPI_INT_FLAGS);
 
 	/* TODO: Handle errors */
 
@@ -565,6 +954,8 @@ static irqreturn_t macb_interrupt(int irq, void *dev_id)
 	if (unlikely(!status))
 		return IRQ_NONE;
 
+	bp->sw_stats.irqs++;
+
 	spin_lock(&bp->lock);
 
 	while (status) {
@@ -574,21 +965,26 @@ static irqreturn_t macb_interrupt(int irq, void *dev_id)
 			break;
 		}
 
-		if (status & MACB_RX_INT_FLAGS) {
+		if (status & MACB_BIT(RXUBR))
+			bp->sw_stats.rx_ring_exhausted++;
+		if (status & MACB_BIT(ISR_ROVR))
+			bp->sw_stats.rx_overruns++;
+
+		if (status & MACB_NAPI_INT_FLAGS) {
 			if (napi_schedule_prep(&bp->napi)) {
 				/*
 				 * There's no point taking any more interrupts
 				 * until we have processed the buffers
 				 */
-				macb_writel(bp, IDR, MACB_RX_INT_FLAGS);
+				macb_writel(bp, IDR, MACB_NAPI_INT_FLAGS);
 				dev_dbg(&bp->pdev->dev,
-					"scheduling RX softirq\n");
+					"scheduling RX/TX softirq\n");
 				__napi_schedule(&bp->napi);
 			}
 		}
 
-		if (status & (MACB_BIT(TCOMP) | MACB_BIT(ISR_TUND) |
-			    MACB_BIT(ISR_RLE)))
+		/* TX errors reset the ring, don't leave that to NAPI */
+		if (status & (MACB_BIT(ISR_TUND) | MACB_BIT(ISR_RLE)))
 			macb_tx(bp);
 
 		/*
@@ -619,6 +1015,10 @@ static int macb_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	dma_addr_t mapping;
 	unsigned int len, entry;
 	u32 ctrl;
+#if defined(CONFIG_ARCH_AT91) && defined(CONFIG_MACB_TX_SRAM)
+	unsigned int sram_len;
+	int offset;
+#endif
 
 #ifdef DEBUG
 	int i;
@@ -637,7 +1037,7 @@ static int macb_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	spin_lock_irq(&bp->lock);
 
 	/* This is a hard error, log it. */
-	if (TX_BUFFS_AVAIL(bp) < 1) {
+	if (macb_tx_full(bp)) {
 		netif_stop_queue(dev);
 		spin_unlock_irq(&bp->lock);
 		dev_err(&bp->pdev->dev,
@@ -650,8 +1050,14 @@ static int macb_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	entry = bp->tx_head;
 	dev_dbg(&bp->pdev->dev, "Allocated ring entry %u\n", entry);
 #if defined(CONFIG_ARCH_AT91) && defined(CONFIG_MACB_TX_SRAM)
-	mapping = bp->tx_ring[entry].addr;
-	memcpy(bp->tx_buffers + entry * TX_BUFFER_SIZE, skb->data, len);
+	/* macb_tx_full() made sure that a full-sized frame fits */
+	offset = macb_tx_sram_offset(bp, ALIGN(len, TX_SRAM_ALIGN), &sram_len);
+	BUG_ON(offset < 0);
+	mapping = bp->tx_buffers_dma + offset;
+	memcpy(bp->tx_buffers + offset, skb->data, len);
+	bp->tx_sram_head = offset + ALIGN(len, TX_SRAM_ALIGN);
+	bp->tx_sram_used += sram_len;
+	bp->tx_skb[entry].sram_len = sram_len;
 #else
 	mapping = dma_map_single(&bp->pdev->dev, skb->data,
 				 len, DMA_TO_DEVICE);
@@ -666,9 +1072,7 @@ static int macb_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	if (entry == (TX_RING_SIZE - 1))
 		ctrl |= MACB_BIT(TX_WRAP);
 
-#if !defined(CONFIG_MACB_TX_SRAM)
 	bp->tx_ring[entry].addr = mapping;
-#endif
 	bp->tx_ring[entry].ctrl = ctrl;
 	wmb();
 
@@ -677,8 +1081,10 @@ static int macb_start_xmit(struct sk_buff *skb, struct net_device *dev)
 
 	macb_writel(bp, NCR, macb_readl(bp, NCR) | MACB_BIT(TSTART));
 
-	if (TX_BUFFS_AVAIL(bp) < 1)
+	if (macb_tx_full(bp)) {
 		netif_stop_queue(dev);
+		bp->sw_stats.tx_queue_stops++;
+	}
 
 	spin_unlock_irq(&bp->lock);
 
@@ -687,6 +1093,37 @@ static int macb_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	return 0;
 }
 
+static void macb_free_rx_buffers(struct macb *bp)
+{
+	int i;
+
+	for (i = 0; i < RX_RING_SIZE; i++) {
+		struct macb_rx_buf *buf = &bp->rx_buf[i];
+
+		if (!buf->page)
+			continue;
+		dma_unmap_page(&bp->pdev->dev, buf->mapping, RX_BUFFER_SIZE,
+			       DMA_FROM_DEVICE);
+		put_page(buf->page);
+		buf->page = NULL;
+	}
+
+	for (i = 0; i < MACB_RX_POOL_SIZE; i++) {
+		if (bp->rx_pool[i]) {
+			put_page(bp->rx_pool[i]);
+			bp->rx_pool[i] = NULL;
+		}
+	}
+	if (bp->rx_page) {
+		put_page(bp->rx_page);
+		bp->rx_page = NULL;
+	}
+	if (bp->rx_spare) {
+		put_page(bp->rx_spare);
+		bp->rx_spare = NULL;
+	}
+}
+
 static void macb_free_consistent(struct macb *bp)
 {
 	if (bp->tx_skb) {
@@ -707,11 +1144,10 @@ static void macb_free_consistent(struct macb *bp)
 #endif
 		bp->tx_ring = NULL;
 	}
-	if (bp->rx_buffers) {
-		dma_free_coherent(&bp->pdev->dev,
-				  RX_RING_SIZE * RX_BUFFER_SIZE,
-				  bp->rx_buffers, bp->rx_buffers_dma);
-		bp->rx_buffers = NULL;
+	if (bp->rx_buf) {
+		macb_free_rx_buffers(bp);
+		kfree(bp->rx_buf);
+		bp->rx_buf = NULL;
 	}
 
 #if defined(CONFIG_ARCH_AT91) && defined(CONFIG_MACB_TX_SRAM)
@@ -723,6 +1159,7 @@ static void macb_free_consistent(struct macb *bp)
 static int macb_alloc_consistent(struct macb *bp)
 {
 	int size;
+	int i;
 
 	size = TX_RING_SIZE * sizeof(struct ring_info);
 	bp->tx_skb = kmalloc(size, GFP_KERNEL);
@@ -778,14 +1215,19 @@ static int macb_alloc_consistent(struct macb *bp)
 		size, (unsigned long)bp->tx_ring_dma, bp->tx_ring);
 #endif
 
-	size = RX_RING_SIZE * RX_BUFFER_SIZE;
-	bp->rx_buffers = dma_alloc_coherent(&bp->pdev->dev, size,
-					    &bp->rx_buffers_dma, GFP_KERNEL);
-	if (!bp->rx_buffers)
+	size = RX_RING_SIZE * sizeof(struct macb_rx_buf);
+	bp->rx_buf = kzalloc(size, GFP_KERNEL);
+	if (!bp->rx_buf)
 		goto out_err;
-	dev_dbg(&bp->pdev->dev,
-		"Allocated RX buffers of %d bytes at %08lx (mapped %p)\n",
-		size, (unsigned long)bp->rx_buffers_dma, bp->rx_buffers);
+
+	for (i = 0; i < RX_RING_SIZE; i++) {
+		bp->rx_ring[i].addr = 0;
+		if (macb_rx_reserve(bp, GFP_KERNEL))
+			goto out_err;
+		macb_rx_map_buf(bp, i);
+	}
+	dev_dbg(&bp->pdev->dev, "Allocated %d RX buffers of %d bytes\n",
+		RX_RING_SIZE, RX_BUFFER_SIZE);
 
 	return 0;
 
@@ -797,21 +1239,19 @@ out_err:
 static void macb_init_rings(struct macb *bp)
 {
 	int i;
-	dma_addr_t addr;
 
-	addr = bp->rx_buffers_dma;
 	for (i = 0; i < RX_RING_SIZE; i++) {
-		bp->rx_ring[i].addr = addr;
+		bp->rx_ring[i].addr = bp->rx_buf[i].mapping;
 		bp->rx_ring[i].ctrl = 0;
-		addr += RX_BUFFER_SIZE;
 	}
 	bp->rx_ring[RX_RING_SIZE - 1].addr |= MACB_BIT(RX_WRAP);
 
 #if defined(CONFIG_ARCH_AT91) && defined(CONFIG_MACB_TX_SRAM)
 	for (i = 0; i < TX_RING_SIZE; i++) {
-		bp->tx_ring[i].addr = bp->tx_buffers_dma + i * TX_BUFFER_SIZE;
+		bp->tx_ring[i].addr = bp->tx_buffers_dma;
 		bp->tx_ring[i].ctrl = MACB_BIT(TX_USED);
 	}
+	bp->tx_sram_head = bp->tx_sram_used = 0;
 #else
 	for (i = 0; i < TX_RING_SIZE; i++) {
 		bp->tx_ring[i].addr = 0;
@@ -1025,6 +1465,10 @@ static int macb_open(struct net_device *dev)
 
 	napi_enable(&bp->napi);
 
+	if (bp->coalesce_usecs && macb_coalesce_init(bp))
+		dev_warn(&bp->pdev->dev,
+			 "no TC channel, interrupt coalescing disabled\n");
+
 	macb_init_rings(bp);
 	macb_init_hw(bp);
 
@@ -1043,6 +1487,7 @@ static int macb_close(struct net_device *dev)
 
 	netif_stop_queue(dev);
 	napi_disable(&bp->napi);
+	macb_coalesce_exit(bp);
 
 	if (bp->phy_dev)
 		phy_stop(bp->phy_dev);
@@ -1132,11 +1577,97 @@ static void macb_get_drvinfo(struct net_device *dev,
 	strcpy(info->bus_info, dev_name(&bp->pdev->dev));
 }
 
+/* In the order of struct macb_sw_stats */
+static const char macb_stat_strings[][ETH_GSTRING_LEN] = {
+	"irqs",
+	"napi_polls",
+	"rx_ring_exhausted",
+	"rx_overruns",
+	"tx_queue_stops",
+	"coalesce_holdoffs",
+	"rx_page_allocs",
+	"rx_page_reuses",
+};
+
+static int macb_get_sset_count(struct net_device *dev, int sset)
+{
+	switch (sset) {
+	case ETH_SS_STATS:
+		return ARRAY_SIZE(macb_stat_strings);
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+static void macb_get_strings(struct net_device *dev, u32 sset, u8 *data)
+{
+	if (sset == ETH_SS_STATS)
+		memcpy(data, macb_stat_strings, sizeof(macb_stat_strings));
+}
+
+static void macb_get_ethtool_stats(struct net_device *dev,
+				   struct ethtool_stats *stats, u64 *data)
+{
+	struct macb *bp = netdev_priv(dev);
+	u32 *p = &bp->sw_stats.irqs;
+	int i;
+
+	BUILD_BUG_ON(sizeof(bp->sw_stats) != sizeof(macb_stat_strings)
+		     / ETH_GSTRING_LEN * sizeof(u32));
+
+	for (i = 0; i < ARRAY_SIZE(macb_stat_strings); i++)
+		data[i] = p[i];
+}
+
+static int macb_get_coalesce(struct net_device *dev,
+			     struct ethtool_coalesce *ec)
+{
+	struct macb *bp = netdev_priv(dev);
+
+	memset(ec, 0, sizeof(*ec));
+	ec->rx_coalesce_usecs = bp->coalesce_usecs;
+	ec->rx_max_coalesced_frames = bp->coalesce_frames;
+
+	return 0;
+}
+
+/*
+ * TX completions are handled by the same NAPI poll as RX, so the rx-usecs
+ * and rx-frames settings apply to both directions.
+ */
+static int macb_set_coalesce(struct net_device *dev,
+			     struct ethtool_coalesce *ec)
+{
+	struct macb *bp = netdev_priv(dev);
+
+	if (ec->rx_coalesce_usecs > MACB_COALESCE_MAX_USECS)
+		return -EINVAL;
+
+#ifdef CONFIG_MACB_COALESCE
+	if (ec->rx_coalesce_usecs && netif_running(dev) && !bp->tc
+	    && macb_coalesce_init(bp))
+		return -EBUSY;
+#else
+	if (ec->rx_coalesce_usecs)
+		return -EOPNOTSUPP;
+#endif
+
+	bp->coalesce_usecs = ec->rx_coalesce_usecs;
+	bp->coalesce_frames = ec->rx_max_coalesced_frames;
+
+	return 0;
+}
+
 static struct ethtool_ops macb_ethtool_ops = {
 	.get_settings		= macb_get_settings,
 	.set_settings		= macb_set_settings,
 	.get_drvinfo		= macb_get_drvinfo,
 	.get_link		= ethtool_op_get_link,
+	.get_coalesce		= macb_get_coalesce,
+	.set_coalesce		= macb_set_coalesce,
+	.get_sset_count		= macb_get_sset_count,
+	.get_strings		= macb_get_strings,
+	.get_ethtool_stats	= macb_get_ethtool_stats,
 };
 
 static int macb_ioctl(struct net_device *dev, struct ifreq *rq, int cmd)
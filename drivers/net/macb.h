@@ -328,8 +328,26 @@ struct dma_desc {
 struct ring_info {
 	struct sk_buff		*skb;
 	dma_addr_t		mapping;
+#if defined(CONFIG_ARCH_AT91) && defined(CONFIG_MACB_TX_SRAM)
+	unsigned int		sram_len;	/* bytes taken in the SRAM FIFO */
+#endif
 };
 
+/*
+ * One 128-byte RX buffer carved out of a page. The descriptor owns a
+ * page reference for as long as the buffer sits in the ring; the
+ * reference is handed to the skb when the buffer is passed up as a
+ * page fragment.
+ */
+struct macb_rx_buf {
+	struct page		*page;
+	unsigned int		offset;
+	dma_addr_t		mapping;
+};
+
+/* Fully carved pages kept around until the stack releases them */
+#define MACB_RX_POOL_SIZE	16
+
 /*
  * Hardware-collected statistics. Used when updating the network
  * device stats by a periodic timer.
@@ -358,12 +376,31 @@ struct macb_stats {
 	u32	tx_pause_frames;
 };
 
+/* Driver statistics, reported through ethtool -S */
+struct macb_sw_stats {
+	u32	irqs;
+	u32	napi_polls;
+	u32	rx_ring_exhausted;
+	u32	rx_overruns;
+	u32	tx_queue_stops;
+	u32	coalesce_holdoffs;
+	u32	rx_page_allocs;
+	u32	rx_page_reuses;
+};
+
 struct macb {
 	void __iomem		*regs;
 
 	unsigned int		rx_tail;
 	struct dma_desc		*rx_ring;
-	void			*rx_buffers;
+	struct macb_rx_buf	*rx_buf;
+
+	/* page currently being carved into RX buffers, and a spare */
+	struct page		*rx_page;
+	unsigned int		rx_page_offset;
+	struct page		*rx_spare;
+	struct page		*rx_pool[MACB_RX_POOL_SIZE];
+	unsigned int		rx_pool_head;
 
 	unsigned int		tx_head, tx_tail;
 	struct dma_desc		*tx_ring;
@@ -372,6 +409,10 @@ struct macb {
 #if defined(CONFIG_ARCH_AT91)
 	void            *tx_buffers;
 #endif
+#if defined(CONFIG_ARCH_AT91) && defined(CONFIG_MACB_TX_SRAM)
+	unsigned int		tx_sram_head;	/* next free byte in the FIFO */
+	unsigned int		tx_sram_used;	/* bytes in flight, incl. gaps */
+#endif
 
 	spinlock_t		lock;
 	struct platform_device	*pdev;
@@ -382,10 +423,18 @@ struct macb {
 	struct napi_struct	napi;
 	struct net_device_stats	stats;
 	struct macb_stats	hw_stats;
+	struct macb_sw_stats	sw_stats;
+
+	/* interrupt coalescing, see ethtool -C */
+	unsigned int		coalesce_usecs;
+	unsigned int		coalesce_frames;
+#ifdef CONFIG_MACB_COALESCE
+	struct atmel_tc		*tc;
+	unsigned long		tc_khz;
+#endif
 
 	dma_addr_t		rx_ring_dma;
 	dma_addr_t		tx_ring_dma;
-	dma_addr_t		rx_buffers_dma;
 
 #if defined(CONFIG_ARCH_AT91)
 	dma_addr_t      tx_buffers_dma;
@@ -13,9 +13,10 @@
  * it under the terms of the GNU General Public License version 2 as
  * published by the Free Software Foundation.
  *
- * NOTE: Currently this driver only supports the bare minimum for read
- * and write the RTC. The extra features provided by the chip family
- * (alarms, trickle charger, different control registers) are unavailable.
+ * Both chips are accessed with their burst modes, so reading or setting
+ * the time is a single SPI message. The DS139x alarm is supported; its
+ * INT pin must be wired to spi->irq for alarm interrupts. The MAX6902 has
+ * no alarm.
  */
 
 #include <linux/init.h>
@@ -24,6 +25,8 @@
 #include <linux/rtc.h>
 #include <linux/spi/spi.h>
 #include <linux/bcd.h>
+#include <linux/interrupt.h>
+#include <linux/workqueue.h>
 
 #define DS1391_REG_100THS		0x00
 #define DS1391_REG_SECONDS		0x01
@@ -53,15 +56,26 @@
 #define MAX6902_REG_YEAR		0x0D
 #define MAX6902_REG_CONTROL		0x0F
 #define MAX6902_REG_CENTURY		0x13
+#define MAX6902_REG_BURST		0x3F	/* clock burst, | 0x80 to read */
+
+#define DS1391_CONTROL_AIE		0x01	/* alarm interrupt enable */
+#define DS1391_CONTROL_INTCN		0x04	/* INT pin driven by the alarm */
+#define DS1391_STATUS_AF		0x01	/* alarm flag */
+#define DS1391_ALARM_MASK		0x80	/* AxMx: ignore this field */
 
 /* type of RTC for autodetection */ 
 #define MAX6902				0x81
 #define DS1391				0x00
-static int rtctype;
 
 struct ds1391_max6902 {
 	struct rtc_device *rtc;
-	u8 txrx_buf[9];	/* cmd + 8 registers */
+	struct spi_device *spi;
+	int type;		/* MAX6902 or DS1391 */
+	int century;		/* MAX6902 century register, -1 = not read yet */
+	u8 control;		/* DS1391 control register */
+	struct work_struct work;
+	/* DMA-safe: command in [0], data read back into [1..] */
+	u8 txrx_buf[13] ____cacheline_aligned;	/* largest: MAX6902 set time */
 };
 
 //*****************************************************************************
@@ -77,18 +91,6 @@ static int max6902_get_reg(struct device *dev, unsigned char address,
 
 	return spi_write_then_read(spi, data, 1, data, 1);
 }
-static int max6902_set_reg(struct device *dev, unsigned char address,
-				unsigned char data)
-{
-	struct spi_device *spi = to_spi_device(dev);
-	unsigned char buf[2];
-
-	/* MSB must be '0' to write */
-	buf[0] = address & 0x7f;
-	buf[1] = data;
-
-	return spi_write_then_read(spi, buf, 2, NULL, 0);
-}
 
 static int ds1391_get_reg(struct device *dev, unsigned char address,
 				unsigned char *data)
@@ -103,11 +105,12 @@ static int ds1391_get_reg(struct device *dev, unsigned char address,
 	/* Clear MSB to indicate read */
 	chip->txrx_buf[0] = address & 0x7f;
 	/* do the i/o */
-	status = spi_write_then_read(spi, chip->txrx_buf, 1, chip->txrx_buf, 1);
+	status = spi_write_then_read_dma(spi, chip->txrx_buf, 1,
+					 chip->txrx_buf + 1, 1);
 	if (status != 0)
 		return status;
 
-	*data = chip->txrx_buf[0];
+	*data = chip->txrx_buf[1];
 
 	return 0;
 }
@@ -124,7 +127,7 @@ static int ds1391_set_reg(struct device *dev, unsigned char address, unsigned ch
 	chip->txrx_buf[1] = data;
 
 	/* do the i/o */
-	ret = spi_write_then_read(spi, chip->txrx_buf, 2, NULL, 0);
+	ret = spi_write_then_read_dma(spi, chip->txrx_buf, 2, NULL, 0);
 	
 	return ret;
 }
@@ -133,13 +136,23 @@ static int ds1391_set_reg(struct device *dev, unsigned char address, unsigned ch
 //*****************************************************************************
 static int max6902_read_time(struct device *dev, struct rtc_time *dt)
 {
-	int err, century;
 	struct spi_device *spi = to_spi_device(dev);
-	unsigned char buf[8];
+	struct ds1391_max6902 *chip = dev_get_drvdata(dev);
+	unsigned char *buf = chip->txrx_buf + 1;
+	int err;
+
+	/* The century register is not part of the clock burst and is never
+	 * changed by the chip itself, so it is read only once. */
+	if (chip->century < 0) {
+		err = max6902_get_reg(dev, MAX6902_REG_CENTURY, &buf[0]);
+		if (err != 0)
+			return err;
+		chip->century = bcd2bin(buf[0]);
+	}
 
-	buf[0] = 0xbf;	/* Burst read */
+	chip->txrx_buf[0] = MAX6902_REG_BURST | 0x80;	/* Burst read */
 
-	err = spi_write_then_read(spi, buf, 1, buf, 8);
+	err = spi_write_then_read_dma(spi, chip->txrx_buf, 1, buf, 8);
 	if (err != 0)
 		return err;
 
@@ -151,17 +164,7 @@ static int max6902_read_time(struct device *dev, struct rtc_time *dt)
 	dt->tm_mday	= bcd2bin(buf[3]);
 	dt->tm_mon	= bcd2bin(buf[4]) - 1;
 	dt->tm_wday	= bcd2bin(buf[5]);
-	dt->tm_year	= bcd2bin(buf[6]);
-
-	/* Read century */
-	err = max6902_get_reg(dev, MAX6902_REG_CENTURY, &buf[0]);
-	if (err != 0)
-		return err;
-
-	century = bcd2bin(buf[0]) * 100;
-
-	dt->tm_year += century;
-	dt->tm_year -= 1900;
+	dt->tm_year	= bcd2bin(buf[6]) + chip->century * 100 - 1900;
 
 	return rtc_valid_tm(dt);
 }
@@ -170,33 +173,36 @@ static int ds1391_read_time(struct device *dev, struct rtc_time *dt)
 {
 	struct spi_device *spi = to_spi_device(dev);
 	struct ds1391_max6902 *chip = dev_get_drvdata(dev);
+	u8 *buf = chip->txrx_buf + 1;
 	int status;
 
 	/* build the message */
 	chip->txrx_buf[0] = DS1391_REG_SECONDS;
 
 	/* do the i/o */
-	status = spi_write_then_read(spi, chip->txrx_buf, 1, chip->txrx_buf, 8);
+	status = spi_write_then_read_dma(spi, chip->txrx_buf, 1, buf, 7);
 	if (status != 0)
 		return status;
 
 	/* The chip sends data in this order:
 	 * Seconds, Minutes, Hours, Day, Date, Month / Century, Year */
-	dt->tm_sec	= bcd2bin(chip->txrx_buf[0]);
-	dt->tm_min	= bcd2bin(chip->txrx_buf[1]);
-	dt->tm_hour	= bcd2bin(chip->txrx_buf[2]);
-	dt->tm_wday	= bcd2bin(chip->txrx_buf[3]);
-	dt->tm_mday	= bcd2bin(chip->txrx_buf[4]);
+	dt->tm_sec	= bcd2bin(buf[0]);
+	dt->tm_min	= bcd2bin(buf[1]);
+	dt->tm_hour	= bcd2bin(buf[2]);
+	dt->tm_wday	= bcd2bin(buf[3]);
+	dt->tm_mday	= bcd2bin(buf[4]);
 	/* mask off century bit */
-	dt->tm_mon	= bcd2bin(chip->txrx_buf[5] & 0x7f) - 1;
+	dt->tm_mon	= bcd2bin(buf[5] & 0x7f) - 1;
 	/* adjust for century bit */
-	dt->tm_year = bcd2bin(chip->txrx_buf[6]) + ((chip->txrx_buf[5] & 0x80) ? 100 : 0);
+	dt->tm_year = bcd2bin(buf[6]) + ((buf[5] & 0x80) ? 100 : 0);
 
 	return rtc_valid_tm(dt);
 }
 static int ds1391_max6902_read_time(struct device *dev, struct rtc_time *dt)
 {
-	if (rtctype == MAX6902)
+	struct ds1391_max6902 *chip = dev_get_drvdata(dev);
+
+	if (chip->type == MAX6902)
 		return max6902_read_time(dev,dt);
 	else
 		return ds1391_read_time(dev,dt);
@@ -206,29 +212,56 @@ static int ds1391_max6902_read_time(struct device *dev, struct rtc_time *dt)
 //*****************************************************************************
 static int max6902_set_time(struct device *dev, struct rtc_time *dt)
 {
-	dt->tm_year = dt->tm_year + 1900;
+	struct spi_device *spi = to_spi_device(dev);
+	struct ds1391_max6902 *chip = dev_get_drvdata(dev);
+	u8 *buf = chip->txrx_buf;
+	struct spi_transfer x[3];
+	struct spi_message m;
+	int year = dt->tm_year + 1900;
+	int err;
 
 	/* Remove write protection */
-	max6902_set_reg(dev, 0xF, 0);
-
-	max6902_set_reg(dev, 0x01, bin2bcd(dt->tm_sec));
-	max6902_set_reg(dev, 0x03, bin2bcd(dt->tm_min));
-	max6902_set_reg(dev, 0x05, bin2bcd(dt->tm_hour));
-
-	max6902_set_reg(dev, 0x07, bin2bcd(dt->tm_mday));
-	max6902_set_reg(dev, 0x09, bin2bcd(dt->tm_mon + 1));
-	max6902_set_reg(dev, 0x0B, bin2bcd(dt->tm_wday));
-	max6902_set_reg(dev, 0x0D, bin2bcd(dt->tm_year % 100));
-	max6902_set_reg(dev, 0x13, bin2bcd(dt->tm_year / 100));
-
-	/* Compulab used a delay here. However, the datasheet
-	 * does not mention a delay being required anywhere... */
-	/* delay(2000); */
-
-	/* Write protect */
-	max6902_set_reg(dev, 0xF, 0x80);
+	buf[0] = MAX6902_REG_CONTROL;
+	buf[1] = 0;
+
+	/* Century, not covered by the clock burst */
+	buf[2] = MAX6902_REG_CENTURY;
+	buf[3] = bin2bcd(year / 100);
+
+	/* Clock burst; the last byte is the control register and sets the
+	 * write protection again */
+	buf[4] = MAX6902_REG_BURST;
+	buf[5] = bin2bcd(dt->tm_sec);
+	buf[6] = bin2bcd(dt->tm_min);
+	buf[7] = bin2bcd(dt->tm_hour);
+	buf[8] = bin2bcd(dt->tm_mday);
+	buf[9] = bin2bcd(dt->tm_mon + 1);
+	buf[10] = bin2bcd(dt->tm_wday);
+	buf[11] = bin2bcd(year % 100);
+	buf[12] = 0x80;
+
+	/* one message, chip select toggles between the three writes */
+	memset(x, 0, sizeof x);
+	spi_message_init(&m);
+	x[0].tx_buf = &buf[0];
+	x[0].len = 2;
+	x[0].cs_change = 1;
+	spi_message_add_tail(&x[0], &m);
+	x[1].tx_buf = &buf[2];
+	x[1].len = 2;
+	x[1].cs_change = 1;
+	spi_message_add_tail(&x[1], &m);
+	x[2].tx_buf = &buf[4];
+	x[2].len = 9;
+	spi_message_add_tail(&x[2], &m);
+
+	err = spi_sync(spi, &m);
+	if (err == 0)
+		chip->century = year / 100;
+	else
+		chip->century = -1;
 
-	return 0;
+	return err;
 }
 
 static int ds1391_set_time(struct device *dev, struct rtc_time *dt)
@@ -248,23 +281,161 @@ static int ds1391_set_time(struct device *dev, struct rtc_time *dt)
 	chip->txrx_buf[7] = bin2bcd(dt->tm_year % 100);
 
 	/* do the i/o */
-	return spi_write_then_read(spi, chip->txrx_buf, 8, NULL, 0);
+	return spi_write_then_read_dma(spi, chip->txrx_buf, 8, NULL, 0);
 }
 
 static int ds1391_max6902_set_time(struct device *dev, struct rtc_time *dt)
 {
-	if (rtctype == MAX6902)
+	struct ds1391_max6902 *chip = dev_get_drvdata(dev);
+
+	if (chip->type == MAX6902)
 		return max6902_set_time(dev,dt);
 	else
 		return ds1391_set_time(dev,dt);
 }
 
+//*****************************************************************************
+// Alarm Functions (DS139x only)
+//*****************************************************************************
+static int ds1391_read_alarm(struct device *dev, struct rtc_wkalrm *alm)
+{
+	struct spi_device *spi = to_spi_device(dev);
+	struct ds1391_max6902 *chip = dev_get_drvdata(dev);
+	u8 *buf = chip->txrx_buf + 1;
+	int status;
+
+	if (chip->type != DS1391)
+		return -EINVAL;
+
+	/* alarm seconds .. status in one burst */
+	chip->txrx_buf[0] = DS1391_REG_ALARM_SECONDS;
+	status = spi_write_then_read_dma(spi, chip->txrx_buf, 1, buf, 6);
+	if (status != 0)
+		return status;
+
+	/* Seconds, Minutes, Hours, Day/Date, Control, Status; the rtc
+	 * core fills in the fields we leave at -1 */
+	alm->time.tm_sec	= bcd2bin(buf[0] & 0x7f);
+	alm->time.tm_min	= bcd2bin(buf[1] & 0x7f);
+	alm->time.tm_hour	= bcd2bin(buf[2] & 0x3f);
+	alm->time.tm_mday	= bcd2bin(buf[3] & 0x3f);
+	alm->time.tm_mon	= -1;
+	alm->time.tm_year	= -1;
+	alm->time.tm_wday	= -1;
+	alm->time.tm_yday	= -1;
+	alm->time.tm_isdst	= -1;
+
+	chip->control = buf[4];
+	alm->enabled = !!(buf[4] & DS1391_CONTROL_AIE);
+	alm->pending = !!(buf[5] & DS1391_STATUS_AF);
+
+	return 0;
+}
+
+static int ds1391_set_alarm(struct device *dev, struct rtc_wkalrm *alm)
+{
+	struct spi_device *spi = to_spi_device(dev);
+	struct ds1391_max6902 *chip = dev_get_drvdata(dev);
+	u8 *buf = chip->txrx_buf;
+	u8 stat;
+	int status;
+
+	if (chip->type != DS1391)
+		return -EINVAL;
+
+	/* alarm on date, hours, minutes and seconds; the control register
+	 * follows the alarm registers, so it goes in the same burst */
+	if (alm->enabled)
+		chip->control |= DS1391_CONTROL_AIE | DS1391_CONTROL_INTCN;
+	else
+		chip->control &= ~DS1391_CONTROL_AIE;
+
+	buf[0] = DS1391_REG_ALARM_100THS | 0x80;
+	buf[1] = 0;
+	buf[2] = bin2bcd(alm->time.tm_sec);
+	buf[3] = bin2bcd(alm->time.tm_min);
+	buf[4] = bin2bcd(alm->time.tm_hour);
+	buf[5] = bin2bcd(alm->time.tm_mday);
+	buf[6] = chip->control;
+
+	status = spi_write_then_read_dma(spi, buf, 7, NULL, 0);
+	if (status != 0)
+		return status;
+
+	/* clear a stale alarm flag */
+	status = ds1391_get_reg(dev, DS1391_REG_STATUS, &stat);
+	if (status == 0 && (stat & DS1391_STATUS_AF))
+		status = ds1391_set_reg(dev, DS1391_REG_STATUS,
+					stat & ~DS1391_STATUS_AF);
+	return status;
+}
+
+static int ds1391_alarm_irq_enable(struct device *dev, unsigned int enabled)
+{
+	struct ds1391_max6902 *chip = dev_get_drvdata(dev);
+
+	if (chip->type != DS1391)
+		return -EINVAL;
+
+	if (enabled)
+		chip->control |= DS1391_CONTROL_AIE | DS1391_CONTROL_INTCN;
+	else
+		chip->control &= ~DS1391_CONTROL_AIE;
+
+	return ds1391_set_reg(dev, DS1391_REG_CONTROL, chip->control);
+}
+
+/*
+ * The alarm interrupt is handled in a work item, because the status
+ * register can only be read and cleared over SPI. The IRQ stays disabled
+ * until the alarm flag is cleared.
+ */
+static void ds1391_work(struct work_struct *work)
+{
+	struct ds1391_max6902 *chip =
+		container_of(work, struct ds1391_max6902, work);
+	struct device *dev = &chip->spi->dev;
+	u8 stat;
+	int alarm = 0;
+
+	/* txrx_buf is shared with the rtc_class_ops, which the rtc core
+	 * serializes with ops_lock */
+	mutex_lock(&chip->rtc->ops_lock);
+	if (ds1391_get_reg(dev, DS1391_REG_STATUS, &stat) == 0
+			&& (stat & DS1391_STATUS_AF)) {
+		ds1391_set_reg(dev, DS1391_REG_STATUS, stat & ~DS1391_STATUS_AF);
+		alarm = 1;
+	}
+	mutex_unlock(&chip->rtc->ops_lock);
+
+	enable_irq(chip->spi->irq);
+
+	if (alarm) {
+		/* rtc_update_irq() requires an IRQ-disabled context */
+		local_irq_disable();
+		rtc_update_irq(chip->rtc, 1, RTC_AF | RTC_IRQF);
+		local_irq_enable();
+	}
+}
+
+static irqreturn_t ds1391_irq(int irq, void *p)
+{
+	struct ds1391_max6902 *chip = p;
+
+	disable_irq_nosync(irq);
+	schedule_work(&chip->work);
+	return IRQ_HANDLED;
+}
+
 //*****************************************************************************
 // Probe and Remove Functions
 //*****************************************************************************
 static const struct rtc_class_ops ds1391_max6902_rtc_ops = {
 	.read_time	= ds1391_max6902_read_time,
 	.set_time	= ds1391_max6902_set_time,
+	.read_alarm	= ds1391_read_alarm,
+	.set_alarm	= ds1391_set_alarm,
+	.alarm_irq_enable = ds1391_alarm_irq_enable,
 };
 
 static int __devinit ds1391_max6902_probe(struct spi_device *spi)
@@ -282,6 +453,8 @@ static int __devinit ds1391_max6902_probe(struct spi_device *spi)
 		dev_err(&spi->dev, "unable to allocate device memory\n");
 		return -ENOMEM;
 	}
+	chip->spi = spi;
+	chip->century = -1;
 	dev_set_drvdata(&spi->dev, chip);
 
 	// start device autodetection (trickle charge register of DS1391)
@@ -301,12 +474,19 @@ static int __devinit ds1391_max6902_probe(struct spi_device *spi)
 	
 	if (tmp == 0xA6)
 	{
-		rtctype = DS1391;
+		chip->type = DS1391;
 		dev_info(&spi->dev, "probe found DS139x on SPI bus\n");
+
+		res = ds1391_get_reg(&spi->dev, DS1391_REG_CONTROL, &chip->control);
+		if (res != 0) {
+			dev_err(&spi->dev, "unable to read device\n");
+			kfree(chip);
+			return res;
+		}
 	}
 	else
 	{
-		rtctype = MAX6902;
+		chip->type = MAX6902;
 		dev_info(&spi->dev, "probe found MAX6902 on SPI bus\n");
 	}
 	
@@ -317,14 +497,33 @@ static int __devinit ds1391_max6902_probe(struct spi_device *spi)
 		dev_err(&spi->dev, "unable to register device\n");
 		res = PTR_ERR(chip->rtc);
 		kfree(chip);
+		return res;
 	}
 
-	return res;
+	/* alarm interrupt, if the board wired INT to a GPIO */
+	if (chip->type == DS1391 && spi->irq > 0) {
+		INIT_WORK(&chip->work, ds1391_work);
+		res = request_irq(spi->irq, ds1391_irq, 0,
+				  dev_name(&chip->rtc->dev), chip);
+		if (res != 0) {
+			dev_warn(&spi->dev, "unable to request irq %d, "
+				 "no alarm interrupt\n", spi->irq);
+			spi->irq = 0;
+		} else
+			device_init_wakeup(&spi->dev, 1);
+	}
+
+	return 0;
 }
 
 static int __devexit ds1391_max6902_remove(struct spi_device *spi)
 {
-	struct ds1391_max6902 *chip = platform_get_drvdata(spi);
+	struct ds1391_max6902 *chip = dev_get_drvdata(&spi->dev);
+
+	if (chip->type == DS1391 && spi->irq > 0) {
+		free_irq(spi->irq, chip);
+		cancel_work_sync(&chip->work);
+	}
 
 	rtc_device_unregister(chip->rtc);
 	kfree(chip);
@@ -40,6 +40,7 @@
 #include <linux/atmel_serial.h>
 
 #include <asm/io.h>
+#include <asm/uaccess.h>
 
 #include <asm/mach/serial_at91.h>
 #include <mach/board.h>
@@ -50,8 +51,10 @@
 #endif
 
 #define PDC_BUFFER_SIZE		512
-/* Revisit: We should calculate this based on the actual port settings */
-#define PDC_RX_TIMEOUT		(3 * 10)		/* 3 bytes */
+#define PDC_BUFFER_MIN		16
+#define PDC_BUFFER_MAX		16384
+#define PDC_RX_TIMEOUT		3			/* characters */
+#define PDC_RX_TIMEOUT_MAX	0xffff			/* RTOR.TO is 16 bits */
 
 #if defined(CONFIG_SERIAL_ATMEL_CONSOLE) && defined(CONFIG_MAGIC_SYSRQ)
 #define SUPPORT_SYSRQ
@@ -93,6 +96,7 @@
 #define UART_GET_BRGR(port)	__raw_readl((port)->membase + ATMEL_US_BRGR)
 #define UART_PUT_BRGR(port,v)	__raw_writel(v, (port)->membase + ATMEL_US_BRGR)
 #define UART_PUT_RTOR(port,v)	__raw_writel(v, (port)->membase + ATMEL_US_RTOR)
+#define UART_PUT_TTGR(port,v)	__raw_writel(v, (port)->membase + ATMEL_US_TTGR)
 
  /* PDC registers */
 #define UART_PUT_PTCR(port,v)	__raw_writel(v, (port)->membase + ATMEL_PDC_PTCR)
@@ -107,6 +111,9 @@
 #define UART_PUT_TPR(port,v)	__raw_writel(v, (port)->membase + ATMEL_PDC_TPR)
 #define UART_PUT_TCR(port,v)	__raw_writel(v, (port)->membase + ATMEL_PDC_TCR)
 #define UART_GET_TCR(port)	__raw_readl((port)->membase + ATMEL_PDC_TCR)
+#define UART_PUT_TNPR(port,v)	__raw_writel(v, (port)->membase + ATMEL_PDC_TNPR)
+#define UART_PUT_TNCR(port,v)	__raw_writel(v, (port)->membase + ATMEL_PDC_TNCR)
+#define UART_GET_TNCR(port)	__raw_readl((port)->membase + ATMEL_PDC_TNCR)
 
 static int (*atmel_open_hook)(struct uart_port *);
 static void (*atmel_close_hook)(struct uart_port *);
@@ -138,6 +145,9 @@ struct atmel_uart_port {
 	short			use_dma_rx;	/* enable PDC receiver */
 	short			pdc_rx_idx;	/* current PDC RX buffer */
 	struct atmel_dma_buffer	pdc_rx[2];	/* PDC receiver */
+	unsigned int		pdc_rx_size;	/* RX buffer size used on next open */
+	unsigned int		rx_timeout;	/* RX timeout in characters */
+	unsigned int		frame_bits;	/* bit periods per character */
 
 	short			use_dma_tx;	/* enable PDC transmitter */
 	struct atmel_dma_buffer	pdc_tx;		/* PDC transmitter */
@@ -147,6 +157,9 @@ struct atmel_uart_port {
 	unsigned int		irq_status_prev;
 
 	struct circ_buf		rx_ring;
+
+	struct serial_rs485	rs485;		/* RS485 settings */
+	wait_queue_head_t	txempty_wait;	/* woken by TXEMPTY */
 };
 
 static struct atmel_uart_port atmel_ports[ATMEL_MAX_UART];
@@ -284,10 +297,15 @@ static void atmel_stop_tx(struct uart_port *port)
 static void atmel_start_tx(struct uart_port *port)
 {
 	if (atmel_use_dma_tx(port)) {
-		if (UART_GET_PTSR(port) & ATMEL_PDC_TXTEN)
+		if (UART_GET_PTSR(port) & ATMEL_PDC_TXTEN) {
 			/* The transmitter is already running.  Yes, we
-			   really need this.*/
+			   really need this.  If the next-buffer slot is
+			   free, let the tasklet chain the new data behind
+			   the running transfer. */
+			if (!UART_GET_TNCR(port))
+				tasklet_schedule(&to_atmel_uart_port(port)->tasklet);
 			return;
+		}
 
 		UART_PUT_IER(port, ATMEL_US_ENDTX | ATMEL_US_TXBUFE);
 		/* re-enable PDC transmit */
@@ -516,6 +534,12 @@ atmel_handle_transmit(struct uart_port *port, unsigned int pending)
 			tasklet_schedule(&atmel_port->tasklet);
 		}
 	}
+
+	/* last bit (and the RS485 timeguard) has left the wire */
+	if (pending & ATMEL_US_TXEMPTY) {
+		UART_PUT_IDR(port, ATMEL_US_TXEMPTY);
+		wake_up_interruptible(&atmel_port->txempty_wait);
+	}
 }
 
 /*
@@ -564,42 +588,78 @@ static void atmel_tx_dma(struct uart_port *port)
 	struct atmel_uart_port *atmel_port = to_atmel_uart_port(port);
 	struct circ_buf *xmit = &port->info->xmit;
 	struct atmel_dma_buffer *pdc = &atmel_port->pdc_tx;
+	unsigned int tcr, tncr, shift, inflight, pending, pos, endtx;
 	int count;
 
-	/* nothing left to transmit? */
-	if (UART_GET_TCR(port))
-		return;
+	/* in 9-bit mode every character takes two bytes */
+	shift = (UART_GET_MR(port) & ATMEL_US_MODE9) ? 1 : 0;
+
+	/*
+	 * The PDC may move TNCR into TCR between the two reads; read
+	 * again until we get a consistent pair.
+	 */
+	do {
+		tncr = UART_GET_TNCR(port);
+		tcr = UART_GET_TCR(port);
+	} while (tncr != UART_GET_TNCR(port));
 
-	xmit->tail += pdc->ofs;
+	/* retire what has been sent since the last call */
+	inflight = (tcr + tncr) << shift;
+	xmit->tail += pdc->ofs - inflight;
 	xmit->tail &= UART_XMIT_SIZE - 1;
 
-	port->icount.tx += pdc->ofs;
-	pdc->ofs = 0;
+	port->icount.tx += pdc->ofs - inflight;
+	pdc->ofs = inflight;
 
-	/* more to transmit - setup next transfer */
+	if (!inflight)
+		/* disable PDC transmit */
+		UART_PUT_PTCR(port, ATMEL_PDC_TXTDIS);
 
-	/* disable PDC transmit */
-	UART_PUT_PTCR(port, ATMEL_PDC_TXTDIS);
+	/*
+	 * ENDTX stays set until TCR or TNCR is written again, so only ask
+	 * for it while a chained buffer is outstanding; otherwise it would
+	 * fire right away. New data gets chained from atmel_start_tx().
+	 */
+	endtx = tncr ? ATMEL_US_ENDTX : 0;
+
+	/*
+	 * Fill the free current/next buffer slots. The data behind the
+	 * in-flight part goes into TPR/TCR if the PDC is idle, else into
+	 * TNPR/TNCR, so a wrapped write is sent as one burst.
+	 */
+	while (!tncr && !uart_tx_stopped(port)) {
+		pending = uart_circ_chars_pending(xmit) - pdc->ofs;
+		if (!pending)
+			break;
+
+		pos = (xmit->tail + pdc->ofs) & (UART_XMIT_SIZE - 1);
+		count = min(pending, (unsigned int)(UART_XMIT_SIZE - pos));
+		count &= ~shift;
+		if (!count)
+			break;
 
-	if (!uart_circ_empty(xmit) && !uart_tx_stopped(port)) {
 		dma_sync_single_for_device(port->dev,
 					   pdc->dma_addr,
 					   pdc->dma_size,
 					   DMA_TO_DEVICE);
 
-		count = CIRC_CNT_TO_END(xmit->head, xmit->tail, UART_XMIT_SIZE);
-		pdc->ofs = count;
-
-		if(UART_GET_MR(port) & ATMEL_US_MODE9)
-		{
-			count /= 2;
+		if (!tcr) {
+			UART_PUT_TPR(port, pdc->dma_addr + pos);
+			UART_PUT_TCR(port, count >> shift);
+			tcr = count >> shift;
+		} else {
+			UART_PUT_TNPR(port, pdc->dma_addr + pos);
+			UART_PUT_TNCR(port, count >> shift);
+			tncr = count >> shift;
 		}
+		endtx = ATMEL_US_ENDTX;
+		pdc->ofs += count;
+	}
 
-		UART_PUT_TPR(port, pdc->dma_addr + xmit->tail);
-		UART_PUT_TCR(port, count);
+	if (pdc->ofs && !uart_tx_stopped(port)) {
 		/* re-enable PDC transmit and interrupts */
 		UART_PUT_PTCR(port, ATMEL_PDC_TXTEN);
-		UART_PUT_IER(port, ATMEL_US_ENDTX | ATMEL_US_TXBUFE);
+		UART_PUT_IER(port, endtx | ATMEL_US_TXBUFE);
 	}
 
 	if (uart_circ_chars_pending(xmit) < WAKEUP_CHARS)
@@ -674,6 +734,19 @@ static void atmel_rx_from_ring(struct uart_port *port)
 	spin_lock(&port->lock);
 }
 
+/*
+ * Program the receiver timeout for the configured number of characters
+ * at the current character length.
+ */
+static void atmel_set_rx_timeout(struct uart_port *port)
+{
+	struct atmel_uart_port *atmel_port = to_atmel_uart_port(port);
+	unsigned int bits;
+
+	bits = atmel_port->rx_timeout * atmel_port->frame_bits;
+	UART_PUT_RTOR(port, min(bits, (unsigned int)PDC_RX_TIMEOUT_MAX));
+}
+
 static void atmel_rx_from_dma(struct uart_port *port)
 {
 	struct atmel_uart_port *atmel_port = to_atmel_uart_port(port);
@@ -833,17 +906,18 @@ static int atmel_startup(struct uart_port *port)
 	 * Initialize DMA (if necessary)
 	 */
 	if (atmel_use_dma_rx(port)) {
+		unsigned int size = atmel_port->pdc_rx_size;
 		int i;
 
 		for (i = 0; i < 2; i++) {
 			struct atmel_dma_buffer *pdc = &atmel_port->pdc_rx[i];
 
-			pdc->buf = kmalloc(PDC_BUFFER_SIZE, GFP_KERNEL);
+			pdc->buf = kmalloc(size, GFP_KERNEL);
 			if (pdc->buf == NULL) {
 				if (i != 0) {
 					dma_unmap_single(port->dev,
 						atmel_port->pdc_rx[0].dma_addr,
-						PDC_BUFFER_SIZE,
+						atmel_port->pdc_rx[0].dma_size,
 						DMA_FROM_DEVICE);
 					kfree(atmel_port->pdc_rx[0].buf);
 				}
@@ -852,19 +926,19 @@ static int atmel_startup(struct uart_port *port)
 			}
 			pdc->dma_addr = dma_map_single(port->dev,
 						       pdc->buf,
-						       PDC_BUFFER_SIZE,
+						       size,
 						       DMA_FROM_DEVICE);
-			pdc->dma_size = PDC_BUFFER_SIZE;
+			pdc->dma_size = size;
 			pdc->ofs = 0;
 		}
 
 		atmel_port->pdc_rx_idx = 0;
 
 		UART_PUT_RPR(port, atmel_port->pdc_rx[0].dma_addr);
-		UART_PUT_RCR(port, PDC_BUFFER_SIZE);
+		UART_PUT_RCR(port, size);
 
 		UART_PUT_RNPR(port, atmel_port->pdc_rx[1].dma_addr);
-		UART_PUT_RNCR(port, PDC_BUFFER_SIZE);
+		UART_PUT_RNCR(port, size);
 	}
 	if (atmel_use_dma_tx(port)) {
 		struct atmel_dma_buffer *pdc = &atmel_port->pdc_tx;
@@ -904,7 +978,7 @@ static int atmel_startup(struct uart_port *port)
 
 	if (atmel_use_dma_rx(port)) {
 		/* set UART timeout */
-		UART_PUT_RTOR(port, PDC_RX_TIMEOUT);
+		atmel_set_rx_timeout(port);
 		UART_PUT_CR(port, ATMEL_US_STTTO);
 
 		UART_PUT_IER(port, ATMEL_US_ENDRX | ATMEL_US_TIMEOUT);
@@ -918,20 +992,21 @@ static int atmel_startup(struct uart_port *port)
 	/* although the bootstrap code initializes the AVR clock properly,
 	   we must tell the kernel to use the clock, or it will be disabled. */ 
 	
-	if (at91_platform_type()==AMM)
+	switch (at91_platform_type())
 	{
-		printk("<0>atmel_serial: AM-M (AVR clock from PLLB)\n");
+	case AMM:
+	case AM3:
+		printk("<0>atmel_serial: %s (AVR clock from PLLB)\n", at91_platform_name());
 		
-		// AVR clock on AM-M
+		// AVR clock on AM-M and AM300
 		pck0 = clk_get(NULL,"pck0");
 		if (IS_ERR(pck0)) {
 			printk(KERN_ERR "atmel_serial: pck0 not defined!\n");
 			return -ENODEV;
 		}
 		clk_enable(pck0);
-	}
-	else if (at91_platform_type()==AML)
-	{
+		break;
+	case AML:
 		printk("<0>atmel_serial: AM-L (AVR clock from Timer5)\n");
 		// AVR clock on AM-L
 		tc5_clk = clk_get(NULL,"tc5_clk");
@@ -940,21 +1015,8 @@ static int atmel_startup(struct uart_port *port)
 			return -ENODEV;
 		}
 		clk_enable(tc5_clk);
-	}
-	else if (at91_platform_type()==AM3)
-	{
-		printk("<0>atmel_serial: AM300 (AVR clock from PLLB)\n");
-		
-		// AVR clock on AM300
-		pck0 = clk_get(NULL,"pck0");
-		if (IS_ERR(pck0)) {
-			printk(KERN_ERR "atmel_serial: pck0 not defined!\n");
-			return -ENODEV;
-		}
-		clk_enable(pck0);
-	}
-	else
-	{
+		break;
+	default:
 		printk(KERN_ERR "atmel_serial: board type not defined!\n");
 		return -ENODEV;
 	}
@@ -1026,6 +1088,8 @@ static void atmel_flush_buffer(struct uart_port *port)
 	struct atmel_uart_port *atmel_port = to_atmel_uart_port(port);
 
 	if (atmel_use_dma_tx(port)) {
+		/* clear the next counter first, or it is reloaded */
+		UART_PUT_TNCR(port, 0);
 		UART_PUT_TCR(port, 0);
 		atmel_port->pdc_tx.ofs = 0;
 	}
@@ -1072,13 +1136,14 @@ static void atmel_serial_pm(struct uart_port *port, unsigned int state,
 static void atmel_set_termios(struct uart_port *port, struct ktermios *termios,
 			      struct ktermios *old)
 {
+	struct atmel_uart_port *atmel_port = to_atmel_uart_port(port);
 	unsigned long flags;
-	unsigned int mode, imr, quot, baud;
+	unsigned int mode, imr, quot, baud, bits;
 
 	/* Get current mode register */
 	mode = UART_GET_MR(port) & ~(ATMEL_US_USCLKS | ATMEL_US_CHRL
-					| ATMEL_US_NBSTOP | ATMEL_US_PAR);
-					//| ATMEL_US_USMODE);
+					| ATMEL_US_NBSTOP | ATMEL_US_PAR
+					| ATMEL_US_USMODE);
 
 	baud = uart_get_baud_rate(port, termios, old, 0, port->uartclk / 16);
 	quot = uart_get_divisor(port, baud);
@@ -1092,24 +1157,32 @@ static void atmel_set_termios(struct uart_port *port, struct ktermios *termios,
 	switch (termios->c_cflag & CSIZE) {
 	case CS5:
 		mode |= ATMEL_US_CHRL_5;
+		bits = 5;
 		break;
 	case CS6:
 		mode |= ATMEL_US_CHRL_6;
+		bits = 6;
 		break;
 	case CS7:
 		mode |= ATMEL_US_CHRL_7;
+		bits = 7;
 		break;
 	default:
 		mode |= ATMEL_US_CHRL_8;
+		bits = 8;
 		break;
 	}
+	bits += 2;	/* start and stop bit */
 
 	/* stop bits */
-	if (termios->c_cflag & CSTOPB)
+	if (termios->c_cflag & CSTOPB) {
 		mode |= ATMEL_US_NBSTOP_2;
+		bits++;
+	}
 
 	/* parity */
 	if (termios->c_cflag & PARENB) {
+		bits++;
 		/* Mark or Space parity */
 		if (termios->c_cflag & CMSPAR) {
 			if (termios->c_cflag & PARODD)
@@ -1123,11 +1196,10 @@ static void atmel_set_termios(struct uart_port *port, struct ktermios *termios,
 	} else
 		mode |= ATMEL_US_PAR_NONE;
 
-	/* hardware handshake (RTS/CTS & RS485) 
-	   AMM specific code: enable RS485 mode */	
-	if ((unsigned int)(port->mapbase) == AT91SAM9260_BASE_US0) {		
+	/* hardware handshake (RTS/CTS & RS485) */
+	if (atmel_port->rs485.flags & SER_RS485_ENABLED)
 		mode |= ATMEL_US_USMODE_RS485;
-	} else if (termios->c_cflag & CRTSCTS)
+	else if (termios->c_cflag & CRTSCTS)
 		mode |= ATMEL_US_USMODE_HWHS;
 	else
 		mode |= ATMEL_US_USMODE_NORMAL;
@@ -1185,13 +1257,25 @@ static void atmel_set_termios(struct uart_port *port, struct ktermios *termios,
 			| ATMEL_US_MODE9|ATMEL_US_OVER
 			| ATMEL_US_PAR_NONE|ATMEL_US_NBSTOP_1|ATMEL_US_CHMODE_NORMAL;
 			
-		UART_PUT_RCR(port, PDC_BUFFER_SIZE/2);
-		UART_PUT_RNCR(port, PDC_BUFFER_SIZE/2);
+		UART_PUT_RCR(port, atmel_port->pdc_rx[0].dma_size / 2);
+		UART_PUT_RNCR(port, atmel_port->pdc_rx[1].dma_size / 2);
 
 		UART_PUT_BRGR(port, 135);
+		bits = 11;	/* start, 9 data, stop */
 	} else {
 		UART_PUT_BRGR(port, quot);
 	}
+
+	/* RS485: keep RTS asserted for the timeguard after the last bit */
+	if (atmel_port->rs485.flags & SER_RS485_ENABLED)
+		UART_PUT_TTGR(port, atmel_port->rs485.delay_rts_after_send);
+	else
+		UART_PUT_TTGR(port, 0);
+
+	/* receiver timeout scales with the character length */
+	atmel_port->frame_bits = bits;
+	if (atmel_use_dma_rx(port))
+		atmel_set_rx_timeout(port);
 	
 	UART_PUT_CR(port, ATMEL_US_RSTSTA | ATMEL_US_RSTRX);
 	UART_PUT_CR(port, ATMEL_US_TXEN | ATMEL_US_RXEN);
@@ -1209,6 +1293,95 @@ static void atmel_set_termios(struct uart_port *port, struct ktermios *termios,
 	spin_unlock_irqrestore(&port->lock, flags);
 }
 
+/*
+ * Sleep until the last character including the RS485 timeguard has been
+ * sent, so tcdrain() returns as soon as the bus may be turned around.
+ */
+static void atmel_wait_tx_empty(struct uart_port *port, unsigned long timeout)
+{
+	struct atmel_uart_port *atmel_port = to_atmel_uart_port(port);
+	unsigned long flags;
+
+	if (atmel_tx_empty(port))
+		return;
+
+	spin_lock_irqsave(&port->lock, flags);
+	UART_PUT_IER(port, ATMEL_US_TXEMPTY);
+	spin_unlock_irqrestore(&port->lock, flags);
+
+	wait_event_interruptible_timeout(atmel_port->txempty_wait,
+					 atmel_tx_empty(port), timeout);
+
+	spin_lock_irqsave(&port->lock, flags);
+	UART_PUT_IDR(port, ATMEL_US_TXEMPTY);
+	spin_unlock_irqrestore(&port->lock, flags);
+}
+
+/*
+ * Apply new RS485 settings. The USART has no delay before send, so
+ * delay_rts_before_send is reported back as 0. delay_rts_after_send is
+ * the timeguard in bit periods (TTGR, 0..255).
+ */
+static void atmel_config_rs485(struct uart_port *port,
+			       struct serial_rs485 *rs485)
+{
+	struct atmel_uart_port *atmel_port = to_atmel_uart_port(port);
+	unsigned long flags;
+	unsigned int mode;
+
+	rs485->flags &= SER_RS485_ENABLED;
+	rs485->delay_rts_before_send = 0;
+	rs485->delay_rts_after_send = min(rs485->delay_rts_after_send, 255U);
+	memset(rs485->padding, 0, sizeof(rs485->padding));
+
+	spin_lock_irqsave(&port->lock, flags);
+
+	atmel_port->rs485 = *rs485;
+
+	mode = UART_GET_MR(port);
+	if (rs485->flags & SER_RS485_ENABLED) {
+		mode = (mode & ~ATMEL_US_USMODE) | ATMEL_US_USMODE_RS485;
+		UART_PUT_TTGR(port, rs485->delay_rts_after_send);
+	} else {
+		if ((mode & ATMEL_US_USMODE) == ATMEL_US_USMODE_RS485)
+			mode = (mode & ~ATMEL_US_USMODE)
+				| ATMEL_US_USMODE_NORMAL;
+		UART_PUT_TTGR(port, 0);
+	}
+	UART_PUT_MR(port, mode);
+
+	spin_unlock_irqrestore(&port->lock, flags);
+}
+
+static int atmel_ioctl(struct uart_port *port, unsigned int cmd,
+		       unsigned long arg)
+{
+	struct serial_rs485 rs485;
+
+	switch (cmd) {
+	case TIOCSRS485:
+		if (copy_from_user(&rs485, (struct serial_rs485 __user *)arg,
+				   sizeof(rs485)))
+			return -EFAULT;
+		atmel_config_rs485(port, &rs485);
+		/* return the settings actually applied */
+		if (copy_to_user((struct serial_rs485 __user *)arg, &rs485,
+				 sizeof(rs485)))
+			return -EFAULT;
+		return 0;
+
+	case TIOCGRS485:
+		rs485 = to_atmel_uart_port(port)->rs485;
+		if (copy_to_user((struct serial_rs485 __user *)arg, &rs485,
+				 sizeof(rs485)))
+			return -EFAULT;
+		return 0;
+
+	default:
+		return -ENOIOCTLCMD;
+	}
+}
+
 /*
  * Return string describing the specified port
  */
@@ -1302,6 +1475,8 @@ static struct uart_ops atmel_pops = {
 	.shutdown	= atmel_shutdown,
 	.flush_buffer	= atmel_flush_buffer,
 	.set_termios	= atmel_set_termios,
+	.ioctl		= atmel_ioctl,
+	.wait_tx_empty	= atmel_wait_tx_empty,
 	.type		= atmel_type,
 	.release_port	= atmel_release_port,
 	.request_port	= atmel_request_port,
@@ -1353,6 +1528,13 @@ static void __devinit atmel_init_port(struct atmel_uart_port *atmel_port,
 
 	atmel_port->use_dma_rx = data->use_dma_rx;
 	atmel_port->use_dma_tx = data->use_dma_tx;
+	atmel_port->rs485 = data->rs485;
+	init_waitqueue_head(&atmel_port->txempty_wait);
+	if (!atmel_port->pdc_rx_size) {
+		atmel_port->pdc_rx_size = PDC_BUFFER_SIZE;
+		atmel_port->rx_timeout = PDC_RX_TIMEOUT;
+		atmel_port->frame_bits = 10;
+	}
 	if (atmel_use_dma_tx(port)){
 		port->fifosize = PDC_BUFFER_SIZE;
 	}
@@ -1602,6 +1784,107 @@ static int atmel_serial_resume(struct platform_device *pdev)
 #define atmel_serial_resume NULL
 #endif
 
+/*
+ * sysfs attributes to tune PDC reception per port. New values take
+ * effect when the port is opened the next time.
+ */
+static ssize_t atmel_show_pdc_rx_size(struct device *dev,
+				      struct device_attribute *attr, char *buf)
+{
+	struct uart_port *port = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", to_atmel_uart_port(port)->pdc_rx_size);
+}
+
+static ssize_t atmel_store_pdc_rx_size(struct device *dev,
+				       struct device_attribute *attr,
+				       const char *buf, size_t count)
+{
+	struct uart_port *port = dev_get_drvdata(dev);
+	unsigned long size = simple_strtoul(buf, NULL, 0);
+
+	/* even, so that 9-bit characters never straddle two buffers */
+	if (size < PDC_BUFFER_MIN || size > PDC_BUFFER_MAX || (size & 1))
+		return -EINVAL;
+
+	to_atmel_uart_port(port)->pdc_rx_size = size;
+	return count;
+}
+
+static ssize_t atmel_show_rx_timeout(struct device *dev,
+				     struct device_attribute *attr, char *buf)
+{
+	struct uart_port *port = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u\n", to_atmel_uart_port(port)->rx_timeout);
+}
+
+static ssize_t atmel_store_rx_timeout(struct device *dev,
+				      struct device_attribute *attr,
+				      const char *buf, size_t count)
+{
+	struct uart_port *port = dev_get_drvdata(dev);
+	unsigned long chars = simple_strtoul(buf, NULL, 0);
+
+	if (chars < 1 || chars > 255)
+		return -EINVAL;
+
+	to_atmel_uart_port(port)->rx_timeout = chars;
+	return count;
+}
+
+static DEVICE_ATTR(pdc_rx_size, 0644, atmel_show_pdc_rx_size,
+		   atmel_store_pdc_rx_size);
+static DEVICE_ATTR(rx_timeout, 0644, atmel_show_rx_timeout,
+		   atmel_store_rx_timeout);
+
+static struct attribute *atmel_serial_attrs[] = {
+	&dev_attr_pdc_rx_size.attr,
+	&dev_attr_rx_timeout.attr,
+	NULL
+};
+
+static struct attribute_group atmel_serial_attr_group = {
+	.attrs	= atmel_serial_attrs,
+};
+
+/*
+ * Worst-case time in microseconds between a character arriving on the
+ * wire and its delivery to the line discipline. With PDC reception data
+ * is only pushed on ENDRX or on the receiver timeout, so that is one full
+ * receive buffer plus the timeout. Line disciplines that end frames on
+ * idle time must not wait less than this.
+ */
+unsigned int atmel_serial_rx_latency(struct tty_struct *tty)
+{
+	struct uart_state *state = tty->driver_data;
+	struct uart_port *port;
+	struct atmel_uart_port *atmel_port;
+	unsigned int chars, cd, baud;
+
+	if (tty->driver->driver_state != &atmel_uart || !state)
+		return 0;
+
+	port = state->port;
+	atmel_port = to_atmel_uart_port(port);
+	if (!atmel_use_dma_rx(port))
+		return jiffies_to_usecs(1);	/* tasklet */
+
+	/* in 9-bit mode every character takes two bytes */
+	chars = atmel_port->pdc_rx[atmel_port->pdc_rx_idx].dma_size;
+	if (UART_GET_MR(port) & ATMEL_US_MODE9)
+		chars /= 2;
+	chars += atmel_port->rx_timeout;
+
+	cd = UART_GET_BRGR(port) & ATMEL_US_CD;
+	if (!cd)
+		return 0;
+	baud = port->uartclk / ((UART_GET_MR(port) & ATMEL_US_OVER) ? 8 : 16) / cd;
+
+	return div_u64((u64)chars * atmel_port->frame_bits * USEC_PER_SEC, baud);
+}
+EXPORT_SYMBOL_GPL(atmel_serial_rx_latency);
+
 static int __devinit atmel_serial_probe(struct platform_device *pdev)
 {
 	struct atmel_uart_port *port;
@@ -1640,6 +1923,11 @@ static int __devinit atmel_serial_probe(struct platform_device *pdev)
 	device_init_wakeup(&pdev->dev, 1);
 	platform_set_drvdata(pdev, port);
 
+	if (atmel_use_dma_rx(&port->uart)
+			&& sysfs_create_group(&pdev->dev.kobj,
+					      &atmel_serial_attr_group))
+		dev_warn(&pdev->dev, "failed to create sysfs attributes\n");
+
 	return 0;
 
 err_add_port:
@@ -1660,6 +1948,9 @@ static int __devexit atmel_serial_remove(struct platform_device *pdev)
 	struct atmel_uart_port *atmel_port = to_atmel_uart_port(port);
 	int ret = 0;
 
+	if (atmel_use_dma_rx(port))
+		sysfs_remove_group(&pdev->dev.kobj, &atmel_serial_attr_group);
+
 	device_init_wakeup(&pdev->dev, 0);
 	platform_set_drvdata(pdev, NULL);
 
@@ -1387,6 +1387,12 @@ static void uart_wait_until_sent(struct tty_struct *tty, int timeout)
 	pr_debug("uart_wait_until_sent(%d), jiffies=%lu, expire=%lu...\n",
 		port->line, jiffies, expire);
 
+	if (port->ops->wait_tx_empty) {
+		port->ops->wait_tx_empty(port, timeout);
+		unlock_kernel();
+		return;
+	}
+
 	/*
 	 * Check whether the transmitter is empty every 'char_time'.
 	 * 'timeout' / 'expire' give us the maximum amount of time
@@ -49,6 +49,13 @@ struct atmel_spi {
 
 	void			*buffer;
 	dma_addr_t		buffer_dma;
+
+	/* messages up to pio_threshold bytes are done with PIO */
+	unsigned int		pio_threshold;
+	unsigned long		pio_messages;
+	unsigned long		pio_bytes;
+	unsigned long		dma_messages;
+	unsigned long		dma_bytes;
 };
 
 /* Controller-specific per-slave state */
@@ -60,6 +67,12 @@ struct atmel_spi_device {
 #define BUFFER_SIZE		PAGE_SIZE
 #define INVALID_DMA_ADDRESS	0xffffffff
 
+/* default for the pio_threshold sysfs attribute, in bytes per message */
+#define PIO_THRESHOLD		16
+#define PIO_THRESHOLD_MAX	256
+#define PIO_TIMEOUT		100000	/* SR polls per word */
+#define PIO_MAX_USECS		16	/* irqs-off budget for one PIO message */
+
 /*
  * Version 2 of the SPI controller has
  *  - CR.LASTXFER
@@ -325,6 +338,19 @@ static void atmel_spi_next_xfer(struct spi_master *master,
 	spi_writel(as, PTCR, SPI_BIT(TXTEN) | SPI_BIT(RXTEN));
 }
 
+/* select chip if it's not still active */
+static void atmel_spi_select(struct atmel_spi *as, struct spi_device *spi)
+{
+	if (as->stay) {
+		if (as->stay != spi) {
+			cs_deactivate(as, as->stay);
+			cs_activate(as, spi);
+		}
+		as->stay = NULL;
+	} else
+		cs_activate(as, spi);
+}
+
 static void atmel_spi_next_message(struct spi_master *master)
 {
 	struct atmel_spi	*as = spi_master_get_devdata(master);
@@ -339,15 +365,7 @@ static void atmel_spi_next_message(struct spi_master *master)
 	dev_dbg(master->dev.parent, "start message %p for %s\n",
 			msg, dev_name(&spi->dev));
 
-	/* select chip if it's not still active */
-	if (as->stay) {
-		if (as->stay != spi) {
-			cs_deactivate(as, as->stay);
-			cs_activate(as, spi);
-		}
-		as->stay = NULL;
-	} else
-		cs_activate(as, spi);
+	atmel_spi_select(as, spi);
 
 	atmel_spi_next_xfer(master, msg);
 }
@@ -545,6 +563,126 @@ atmel_spi_interrupt(int irq, void *dev_id)
 	return ret;
 }
 
+/*
+ * Programmed I/O for short messages.  For a few bytes the DMA mapping
+ * and the ENDRX interrupt take much longer than the data on the wire,
+ * so atmel_spi_transfer() runs such messages right away, busy-waiting
+ * on TDRE/RDRF, if the controller is idle.  Only messages that fit in
+ * both pio_threshold and PIO_MAX_USECS of wire time qualify, so slow
+ * devices still go through DMA.
+ * lock is held, spi irq is blocked
+ */
+static int atmel_spi_pio_wait(struct atmel_spi *as, u32 bit)
+{
+	int	timeout;
+
+	for (timeout = PIO_TIMEOUT; timeout; timeout--)
+		if (spi_readl(as, SR) & bit)
+			return 0;
+	return -EIO;
+}
+
+static int atmel_spi_pio_xfer(struct atmel_spi *as, struct spi_device *spi,
+				struct spi_transfer *xfer)
+{
+	const u8	*tx = xfer->tx_buf;
+	u8		*rx = xfer->rx_buf;
+	int		wide = spi->bits_per_word > 8;
+	unsigned	i;
+	u32		data;
+
+	for (i = 0; i < xfer->len; i += wide ? 2 : 1) {
+		data = 0;
+		if (tx)
+			data = wide ? *(const u16 *)(tx + i) : tx[i];
+
+		if (atmel_spi_pio_wait(as, SPI_BIT(TDRE)))
+			return -EIO;
+		spi_writel(as, TDR, data);
+		if (atmel_spi_pio_wait(as, SPI_BIT(RDRF)))
+			return -EIO;
+		data = spi_readl(as, RDR);
+
+		if (rx) {
+			if (wide)
+				*(u16 *)(rx + i) = data;
+			else
+				rx[i] = data;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Estimate how long a PIO message keeps irqs off: wire time at the
+ * clock programmed for this device, plus the delays it asks for.
+ */
+static unsigned atmel_spi_pio_usecs(struct atmel_spi *as,
+				struct spi_device *spi, struct spi_message *msg,
+				unsigned int total)
+{
+	struct atmel_spi_device	*asd = spi->controller_state;
+	struct spi_transfer	*xfer;
+	unsigned long		bus_hz, khz;
+	unsigned		usecs;
+
+	bus_hz = clk_get_rate(as->clk);
+	if (!atmel_spi_is_v2())
+		bus_hz /= 2;
+	khz = bus_hz / SPI_BFEXT(SCBR, asd->csr) / 1000;
+	if (!khz)
+		return UINT_MAX;
+
+	usecs = DIV_ROUND_UP(total * 8 * 1000, khz);
+	list_for_each_entry(xfer, &msg->transfers, transfer_list)
+		usecs += xfer->delay_usecs + (xfer->cs_change ? 1 : 0);
+
+	return usecs;
+}
+
+static void atmel_spi_pio_message(struct spi_master *master,
+				struct spi_message *msg)
+{
+	struct atmel_spi	*as = spi_master_get_devdata(master);
+	struct spi_transfer	*xfer;
+	int			status = 0;
+	int			stay = 0;
+
+	/* the queue is empty, so this completes right below */
+	list_add_tail(&msg->queue, &as->queue);
+
+	atmel_spi_select(as, msg->spi);
+
+	/* discard stale receive data */
+	spi_readl(as, RDR);
+	spi_readl(as, SR);
+
+	list_for_each_entry(xfer, &msg->transfers, transfer_list) {
+		status = atmel_spi_pio_xfer(as, msg->spi, xfer);
+		if (status < 0) {
+			dev_warn(master->dev.parent, "PIO timeout\n");
+			break;
+		}
+		msg->actual_length += xfer->len;
+
+		if (xfer->delay_usecs)
+			udelay(xfer->delay_usecs);
+
+		if (atmel_spi_xfer_is_last(msg, xfer))
+			stay = xfer->cs_change;
+		else if (xfer->cs_change) {
+			cs_deactivate(as, msg->spi);
+			udelay(1);
+			cs_activate(as, msg->spi);
+		}
+	}
+
+	as->pio_messages++;
+	as->pio_bytes += msg->actual_length;
+
+	atmel_spi_msg_done(master, as, msg, status, stay);
+}
+
 /* the spi->mode bits understood by this driver: */
 #define MODEBITS (SPI_CPOL | SPI_CPHA | SPI_CS_HIGH)
 
@@ -679,6 +817,8 @@ static int atmel_spi_transfer(struct spi_device *spi, struct spi_message *msg)
 	struct spi_transfer	*xfer;
 	unsigned long		flags;
 	struct device		*controller = spi->master->dev.parent;
+	unsigned int		total = 0;
+	int			pio;
 
 	as = spi_master_get_devdata(spi->master);
 
@@ -691,6 +831,11 @@ static int atmel_spi_transfer(struct spi_device *spi, struct spi_message *msg)
 	if (as->stopping)
 		return -ESHUTDOWN;
 
+	list_for_each_entry(xfer, &msg->transfers, transfer_list)
+		total += xfer->len;
+	pio = !msg->is_dma_mapped && total <= as->pio_threshold
+		&& atmel_spi_pio_usecs(as, spi, msg, total) <= PIO_MAX_USECS;
+
 	list_for_each_entry(xfer, &msg->transfers, transfer_list) {
 		if (!(xfer->tx_buf || xfer->rx_buf) && xfer->len) {
 			dev_dbg(&spi->dev, "missing rx or tx buf\n");
@@ -712,8 +857,11 @@ static int atmel_spi_transfer(struct spi_device *spi, struct spi_message *msg)
 		 * NOTE that if dma_unmap_single() ever starts to do work on
 		 * platforms supported by this driver, we would need to clean
 		 * up mappings for previously-mapped transfers.
+		 *
+		 * Short messages are mapped later, and only if they can't
+		 * be done with PIO right away.
 		 */
-		if (!msg->is_dma_mapped) {
+		if (!msg->is_dma_mapped && !pio) {
 			if (atmel_spi_dma_map_xfer(as, xfer) < 0)
 				return -ENOMEM;
 		}
@@ -733,6 +881,30 @@ static int atmel_spi_transfer(struct spi_device *spi, struct spi_message *msg)
 	msg->actual_length = 0;
 
 	spin_lock_irqsave(&as->lock, flags);
+	if (pio && !as->current_transfer && list_empty(&as->queue)) {
+		atmel_spi_pio_message(spi->master, msg);
+		spin_unlock_irqrestore(&as->lock, flags);
+		return 0;
+	}
+	if (pio) {
+		/* controller busy, queue it for DMA after all */
+		list_for_each_entry(xfer, &msg->transfers, transfer_list) {
+			if (atmel_spi_dma_map_xfer(as, xfer) < 0) {
+				struct spi_transfer	*x;
+
+				list_for_each_entry(x, &msg->transfers,
+						transfer_list) {
+					if (x == xfer)
+						break;
+					atmel_spi_dma_unmap_xfer(spi->master, x);
+				}
+				spin_unlock_irqrestore(&as->lock, flags);
+				return -ENOMEM;
+			}
+		}
+	}
+	as->dma_messages++;
+	as->dma_bytes += total;
 	list_add_tail(&msg->queue, &as->queue);
 	if (!as->current_transfer)
 		atmel_spi_next_message(spi->master);
@@ -765,6 +937,63 @@ static void atmel_spi_cleanup(struct spi_device *spi)
 
 /*-------------------------------------------------------------------------*/
 
+/*
+ * sysfs: PIO threshold and per-path message/byte counters
+ */
+static ssize_t pio_threshold_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct spi_master	*master = dev_get_drvdata(dev);
+	struct atmel_spi	*as = spi_master_get_devdata(master);
+
+	return sprintf(buf, "%u\n", as->pio_threshold);
+}
+
+static ssize_t pio_threshold_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	struct spi_master	*master = dev_get_drvdata(dev);
+	struct atmel_spi	*as = spi_master_get_devdata(master);
+	unsigned long		val = simple_strtoul(buf, NULL, 0);
+
+	/* 0 disables PIO; PIO runs with irqs off, so keep it short */
+	if (val > PIO_THRESHOLD_MAX)
+		return -EINVAL;
+	as->pio_threshold = val;
+	return count;
+}
+
+#define ATMEL_SPI_COUNTER(name)						\
+static ssize_t name##_show(struct device *dev,				\
+		struct device_attribute *attr, char *buf)		\
+{									\
+	struct spi_master	*master = dev_get_drvdata(dev);		\
+	struct atmel_spi	*as = spi_master_get_devdata(master);	\
+									\
+	return sprintf(buf, "%lu\n", as->name);			\
+}									\
+static DEVICE_ATTR(name, S_IRUGO, name##_show, NULL)
+
+ATMEL_SPI_COUNTER(pio_messages);
+ATMEL_SPI_COUNTER(pio_bytes);
+ATMEL_SPI_COUNTER(dma_messages);
+ATMEL_SPI_COUNTER(dma_bytes);
+static DEVICE_ATTR(pio_threshold, S_IRUGO | S_IWUSR,
+		pio_threshold_show, pio_threshold_store);
+
+static struct attribute *atmel_spi_attrs[] = {
+	&dev_attr_pio_threshold.attr,
+	&dev_attr_pio_messages.attr,
+	&dev_attr_pio_bytes.attr,
+	&dev_attr_dma_messages.attr,
+	&dev_attr_dma_bytes.attr,
+	NULL,
+};
+
+static const struct attribute_group atmel_spi_attr_group = {
+	.attrs	= atmel_spi_attrs,
+};
+
 static int __init atmel_spi_probe(struct platform_device *pdev)
 {
 	struct resource		*regs;
@@ -813,6 +1042,7 @@ static int __init atmel_spi_probe(struct platform_device *pdev)
 	spin_lock_init(&as->lock);
 	INIT_LIST_HEAD(&as->queue);
 	as->pdev = pdev;
+	as->pio_threshold = PIO_THRESHOLD;
 	as->regs = ioremap(regs->start, (regs->end - regs->start) + 1);
 	if (!as->regs)
 		goto out_free_buffer;
@@ -840,6 +1070,9 @@ static int __init atmel_spi_probe(struct platform_device *pdev)
 	if (ret)
 		goto out_reset_hw;
 
+	if (sysfs_create_group(&pdev->dev.kobj, &atmel_spi_attr_group))
+		dev_warn(&pdev->dev, "can't create sysfs attributes\n");
+
 	return 0;
 
 out_reset_hw:
@@ -864,6 +1097,8 @@ static int __exit atmel_spi_remove(struct platform_device *pdev)
 	struct atmel_spi	*as = spi_master_get_devdata(master);
 	struct spi_message	*msg;
 
+	sysfs_remove_group(&pdev->dev.kobj, &atmel_spi_attr_group);
+
 	/* reset the hardware and block queue progress */
 	spin_lock_irq(&as->lock);
 	as->stopping = 1;
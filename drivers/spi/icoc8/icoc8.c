@@ -21,6 +21,14 @@
 #include <linux/delay.h>
 #include <linux/fs.h>
 #include <linux/types.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/kthread.h>
+#include <linux/time.h>
+#include <linux/spi/spi.h>
 #include <asm/uaccess.h>
 #include <asm/io.h>
 #include <asm/system.h>
@@ -51,18 +59,77 @@ MODULE_LICENSE("GPL");
 #define NPCS02					(1<<16)		// PIOC
 #define NPCS03					(1<<17)		// PIOC
 
+#define ICOC8_SPI_SPEED	500000		// SPI clock for IC8/OC8 transfers [Hz]
+#define OC8_STROBE_US		100				// IOSTROBE low time [us]
+#define IC8_GETINPUTS		IC8_GET0	// IC8 command returning the input byte
+#define IC8_EVENT_QUEUE	64				// input change records buffered for read()
+
 /*-----------------------------------------------------------------------------
  * Global register access pointer
  *---------------------------------------------------------------------------*/
 static void * basePioA;
 static void * basePioC;
 
+/*-----------------------------------------------------------------------------
+ * SPI device state
+ *
+ * icoc8Lock serializes every access to the IC8/OC8 bus: SPI transfers as well
+ * as the chip-select and strobe lines driven next to the SPI core.
+ *---------------------------------------------------------------------------*/
+static struct spi_device * icoc8Spi;
+static DEFINE_MUTEX(icoc8Lock);
+static u8 * icoc8Buf;								// DMA safe transfer buffer
+static ICOC8INFO icoc8Info;					// cached bus topology
+
+/*-----------------------------------------------------------------------------
+ * IC8 input scanner state
+ *
+ * The scan thread samples all detected IC8 modules every scanMs milliseconds
+ * and queues a record for every module whose inputs changed.
+ *---------------------------------------------------------------------------*/
+static unsigned int scanMs = 20;
+static int scanKick;								// period changed, restart the sleep
+
+static struct task_struct * scanTask;
+static DECLARE_WAIT_QUEUE_HEAD(scanWait);
+
+/*-----------------------------------------------------------------------------
+ * icoc8_set_scan_ms()
+ *
+ * scan_ms parameter setter: wake the scan thread so a new period (or a
+ * restart from 0) takes effect at once, like IOCTL_ICOC8_SETSCAN.
+ *---------------------------------------------------------------------------*/
+static int icoc8_set_scan_ms(const char *val, struct kernel_param *kp)
+{
+	int ret;
+
+	ret = param_set_uint(val, kp);
+	if (ret == 0)
+	{
+		scanKick = 1;
+		wake_up_interruptible(&scanWait);
+	}
+	return ret;
+}
+module_param_call(scan_ms, icoc8_set_scan_ms, param_get_uint, &scanMs, 0644);
+MODULE_PARM_DESC(scan_ms, "IC8 input scan period in ms (0 = scanner stopped)");
+static unsigned char ic8Inputs[ICOC8_MAX_IC8];	// last sampled inputs
+static unsigned short ic8Valid;										// bitmask of sampled modules
+
+static IC8EVENT eventQueue[IC8_EVENT_QUEUE];
+static unsigned int eventHead, eventTail;
+static DEFINE_SPINLOCK(eventLock);
+static DECLARE_WAIT_QUEUE_HEAD(eventWait);
+
 /*-----------------------------------------------------------------------------
  * forward function declaration
  *---------------------------------------------------------------------------*/
 void icoc8_exit(void);
 int icoc8_init(void);
 int icoc8_ioctl(struct inode*, struct file* , unsigned int, unsigned long);
+ssize_t icoc8_write(struct file*, const char __user*, size_t, loff_t*);
+ssize_t icoc8_read(struct file*, char __user*, size_t, loff_t*);
+unsigned int icoc8_poll(struct file*, poll_table*);
 module_init(icoc8_init);
 module_exit(icoc8_exit);
 
@@ -72,30 +139,455 @@ module_exit(icoc8_exit);
 struct file_operations icoc8_fops = {
 	owner:	THIS_MODULE,
 	ioctl:	icoc8_ioctl,
+	write:	icoc8_write,
+	read:		icoc8_read,
+	poll:		icoc8_poll,
 };
 
+/*-----------------------------------------------------------------------------
+ * icoc8_set_cs()
+ *
+ * Drive the IC8 address lines NPCS00..NPCS03. Caller holds icoc8Lock.
+ *---------------------------------------------------------------------------*/
+static void icoc8_set_cs(unsigned char chipsel)
+{
+	writel(NPCS00,(chipsel & 0x01)?basePioA+PIO_SODR:basePioA+PIO_CODR);
+	writel(NPCS01,(chipsel & 0x02)?basePioC+PIO_SODR:basePioC+PIO_CODR);
+	writel(NPCS02,(chipsel & 0x04)?basePioC+PIO_SODR:basePioC+PIO_CODR);
+	writel(NPCS03,(chipsel & 0x08)?basePioC+PIO_SODR:basePioC+PIO_CODR);
+}
+
+/*-----------------------------------------------------------------------------
+ * icoc8_strobe()
+ *
+ * Latch the OC8 shift registers into the outputs. Caller holds icoc8Lock.
+ *---------------------------------------------------------------------------*/
+static void icoc8_strobe(void)
+{
+	writel(IOSTROBE, basePioA+PIO_CODR);
+	udelay(OC8_STROBE_US);
+	writel(IOSTROBE, basePioA+PIO_SODR);
+}
+
+/*-----------------------------------------------------------------------------
+ * icoc8_get_ioback()
+ *---------------------------------------------------------------------------*/
+static int icoc8_get_ioback(void)
+{
+	return (readl(basePioA+PIO_PDSR)&IOBACK)>0;
+}
+
+/*-----------------------------------------------------------------------------
+ * icoc8_count_oc8()
+ *
+ * Clock out 0xFF into the OC8 register chain until feedback on IOBACK.
+ * Caller holds icoc8Lock.
+ *---------------------------------------------------------------------------*/
+static int icoc8_count_oc8(void)
+{
+	int nr, ret;
+
+	// empty the OC8 shift registers
+	memset(icoc8Buf, 0, ICOC8_MAX_OC8);
+	ret = spi_write(icoc8Spi, icoc8Buf, ICOC8_MAX_OC8);
+	if (ret)
+		return ret;
+
+	// shift 1's into registers until feedback
+	icoc8Buf[0] = 0xFF;
+	for (nr=0; nr<ICOC8_MAX_OC8; nr++)
+	{
+		if (icoc8_get_ioback())
+			break;
+
+		ret = spi_write(icoc8Spi, icoc8Buf, 1);
+		if (ret)
+			return ret;
+	}
+	if (nr == ICOC8_MAX_OC8)
+		nr = 0;
+
+	return nr;
+}
+
+/*-----------------------------------------------------------------------------
+ * icoc8_transfer()
+ *
+ * Address an IC8 module, send txLen bytes and clock back rxLen answer bytes.
+ * Both parts go out as one spi_message; the SPI chip-select is toggled in
+ * between as the IC8 expects its answer in a separate frame. tx and rx must
+ * be DMA safe. Caller holds icoc8Lock.
+ *---------------------------------------------------------------------------*/
+static int icoc8_transfer(unsigned char chipsel, const u8 *tx, unsigned txLen,
+	u8 *rx, unsigned rxLen)
+{
+	struct spi_transfer t[2];
+	struct spi_message m;
+	int ret;
+
+	spi_message_init(&m);
+	memset(t, 0, sizeof(t));
+	if (txLen)
+	{
+		t[0].tx_buf = tx;
+		t[0].len = txLen;
+		t[0].cs_change = (rxLen != 0);
+		spi_message_add_tail(&t[0], &m);
+	}
+	if (rxLen)
+	{
+		t[1].rx_buf = rx;
+		t[1].len = rxLen;
+		spi_message_add_tail(&t[1], &m);
+	}
+	if (list_empty(&m.transfers))
+		return 0;
+
+	icoc8_set_cs(chipsel);
+	ret = spi_sync(icoc8Spi, &m);
+	icoc8_set_cs(ICOC8_CS_IDLE);
+
+	return ret;
+}
+
+/*-----------------------------------------------------------------------------
+ * icoc8_ic8_command()
+ *
+ * Send a one byte command to an IC8 and return its answer byte.
+ * Caller holds icoc8Lock.
+ *---------------------------------------------------------------------------*/
+static int icoc8_ic8_command(unsigned char module, u8 cmd, u8 *answer)
+{
+	int ret;
+
+	icoc8Buf[0] = cmd;
+	ret = icoc8_transfer(module, &icoc8Buf[0], 1, &icoc8Buf[1], 1);
+	*answer = icoc8Buf[1];
+
+	return ret;
+}
+
+/*-----------------------------------------------------------------------------
+ * icoc8_xfer_batch()
+ *
+ * IOCTL_ICOC8_XFER: run a batch of user transfers back to back. The bus lock
+ * is held across the whole batch so no other transfer, OC8 write or scanner
+ * cycle can slip in between.
+ *---------------------------------------------------------------------------*/
+static int icoc8_xfer_batch(ICOC8BATCH __user *arg)
+{
+	ICOC8BATCH batch;
+	ICOC8XFER *xfer;
+	unsigned int i;
+	int ret = 0;
+
+	if (copy_from_user(&batch, arg, sizeof(batch)))
+		return -EFAULT;
+	if (batch.count == 0)
+		return 0;
+	if (batch.count > ICOC8_BATCH_MAX)
+		return -EINVAL;
+
+	// descriptors double as DMA buffers, so keep them in kmalloc memory
+	xfer = kmalloc(batch.count * sizeof(*xfer), GFP_KERNEL);
+	if (xfer == NULL)
+		return -ENOMEM;
+	if (copy_from_user(xfer, (void __user *)batch.xfer, batch.count * sizeof(*xfer)))
+	{
+		kfree(xfer);
+		return -EFAULT;
+	}
+	for (i=0; i<batch.count; i++)
+	{
+		if (xfer[i].txLen > ICOC8_XFER_MAX || xfer[i].rxLen > ICOC8_XFER_MAX)
+		{
+			kfree(xfer);
+			return -EINVAL;
+		}
+	}
+
+	mutex_lock(&icoc8Lock);
+	if (icoc8Spi == NULL)
+		ret = -ENODEV;
+	for (i=0; ret==0 && i<batch.count; i++)
+		ret = icoc8_transfer(xfer[i].chipsel, xfer[i].tx, xfer[i].txLen,
+			xfer[i].rx, xfer[i].rxLen);
+	mutex_unlock(&icoc8Lock);
+
+	if (ret == 0 && copy_to_user((void __user *)batch.xfer, xfer, batch.count * sizeof(*xfer)))
+		ret = -EFAULT;
+
+	kfree(xfer);
+	return ret;
+}
+
+/*-----------------------------------------------------------------------------
+ * icoc8_count_ic8()
+ *
+ * Count up the IC8 addresses and see how many modules reply to CLEARBUFFER.
+ * Caller holds icoc8Lock.
+ *---------------------------------------------------------------------------*/
+static int icoc8_count_ic8(void)
+{
+	int nr, ret = 0;
+	u8 answer;
+
+	for (nr=0; nr<ICOC8_MAX_IC8; nr++)
+	{
+		ret = icoc8_ic8_command(nr, IC8_CLEARBUFFER, &answer);
+		if (ret || answer != IC8_MODULE)
+			break;
+	}
+
+	return ret ? ret : nr;
+}
+
+/*-----------------------------------------------------------------------------
+ * icoc8_detect()
+ *
+ * (Re)detect the modules on the bus and update the cached topology.
+ * Caller holds icoc8Lock.
+ *---------------------------------------------------------------------------*/
+static int icoc8_detect(void)
+{
+	int ret;
+
+	ret = icoc8_count_oc8();
+	if (ret < 0)
+		return ret;
+	icoc8Info.nrOfOC8 = ret;
+
+	ret = icoc8_count_ic8();
+	if (ret < 0)
+		return ret;
+	icoc8Info.nrOfIC8 = ret;
+	ic8Valid = 0;
+
+	printk("<0>icoc8: detected %d OC8 and %d IC8 modules\n",
+		icoc8Info.nrOfOC8, icoc8Info.nrOfIC8);
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * icoc8_queue_event()
+ *
+ * Append an input change record. When the queue is full the oldest record is
+ * dropped and the new one is flagged with IC8EVENT_OVERFLOW.
+ *---------------------------------------------------------------------------*/
+static void icoc8_queue_event(IC8EVENT *ev)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&eventLock, flags);
+	if (eventHead - eventTail == IC8_EVENT_QUEUE)
+	{
+		eventTail++;
+		ev->flags |= IC8EVENT_OVERFLOW;
+	}
+	eventQueue[eventHead % IC8_EVENT_QUEUE] = *ev;
+	eventHead++;
+	spin_unlock_irqrestore(&eventLock, flags);
+
+	wake_up_interruptible(&eventWait);
+}
+
+/*-----------------------------------------------------------------------------
+ * icoc8_dequeue_event()
+ *---------------------------------------------------------------------------*/
+static int icoc8_dequeue_event(IC8EVENT *ev)
+{
+	unsigned long flags;
+	int ret = 0;
+
+	spin_lock_irqsave(&eventLock, flags);
+	if (eventHead != eventTail)
+	{
+		*ev = eventQueue[eventTail % IC8_EVENT_QUEUE];
+		eventTail++;
+		ret = 1;
+	}
+	spin_unlock_irqrestore(&eventLock, flags);
+
+	return ret;
+}
+
+/*-----------------------------------------------------------------------------
+ * icoc8_scan_module()
+ *
+ * Sample the inputs of one IC8 and queue a record if they changed.
+ *---------------------------------------------------------------------------*/
+static void icoc8_scan_module(unsigned char module)
+{
+	struct timeval tv;
+	IC8EVENT ev;
+	u8 inputs;
+	int ret;
+
+	mutex_lock(&icoc8Lock);
+	if (icoc8Spi == NULL || module >= icoc8Info.nrOfIC8)
+	{
+		mutex_unlock(&icoc8Lock);
+		return;
+	}
+	ret = icoc8_ic8_command(module, IC8_GETINPUTS, &inputs);
+	do_gettimeofday(&tv);
+	if (ret)
+	{
+		mutex_unlock(&icoc8Lock);
+		return;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	if (!(ic8Valid & (1<<module)))
+	{
+		ic8Valid |= (1<<module);
+		ev.flags = IC8EVENT_INITIAL;
+		ev.changed = 0xFF;
+	}
+	else
+		ev.changed = inputs ^ ic8Inputs[module];
+	ic8Inputs[module] = inputs;
+	mutex_unlock(&icoc8Lock);
+
+	if (ev.changed == 0)
+		return;
+
+	ev.sec = tv.tv_sec;
+	ev.usec = tv.tv_usec;
+	ev.module = module;
+	ev.inputs = inputs;
+	icoc8_queue_event(&ev);
+}
+
+/*-----------------------------------------------------------------------------
+ * icoc8_scan_thread()
+ *
+ * Cycle the NPCS00..NPCS03 patterns of all detected IC8 modules. The bus lock
+ * is taken per module so OC8 writes are never held off for a whole scan.
+ *---------------------------------------------------------------------------*/
+static int icoc8_scan_thread(void *data)
+{
+	unsigned char module;
+
+	while (!kthread_should_stop())
+	{
+		wait_event_interruptible(scanWait, scanMs || kthread_should_stop());
+		scanKick = 0;
+
+		for (module=0; module<icoc8Info.nrOfIC8; module++)
+			icoc8_scan_module(module);
+
+		// a new period cuts the current sleep short
+		if (scanMs)
+			wait_event_interruptible_timeout(scanWait,
+				scanKick || kthread_should_stop(), msecs_to_jiffies(scanMs));
+	}
+
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * icoc8_read()
+ *
+ * Return as many whole IC8EVENT records as fit into the user buffer. Blocks
+ * until at least one record is available unless O_NONBLOCK is set.
+ *---------------------------------------------------------------------------*/
+ssize_t icoc8_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+	IC8EVENT ev;
+	ssize_t ret = 0;
+
+	if (count < sizeof(ev))
+		return -EINVAL;
+
+	if (eventHead == eventTail)
+	{
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(eventWait, eventHead != eventTail))
+			return -ERESTARTSYS;
+	}
+
+	while (ret + sizeof(ev) <= count && icoc8_dequeue_event(&ev))
+	{
+		if (copy_to_user(buf + ret, &ev, sizeof(ev)))
+			return -EFAULT;
+		ret += sizeof(ev);
+	}
+
+	return ret;
+}
+
+/*-----------------------------------------------------------------------------
+ * icoc8_poll()
+ *---------------------------------------------------------------------------*/
+unsigned int icoc8_poll(struct file *file, poll_table *wait)
+{
+	unsigned int mask = POLLOUT | POLLWRNORM;
+
+	poll_wait(file, &eventWait, wait);
+	if (eventHead != eventTail)
+		mask |= POLLIN | POLLRDNORM;
+
+	return mask;
+}
+
+/*-----------------------------------------------------------------------------
+ * icoc8_write()
+ *
+ * Shift the written bytes into the OC8 chain and strobe them to the outputs.
+ * The first byte ends up in the module farthest from the CPU.
+ *---------------------------------------------------------------------------*/
+ssize_t icoc8_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+{
+	ssize_t ret;
+
+	if (count == 0)
+		return 0;
+	if (count > ICOC8_MAX_OC8)
+		return -EMSGSIZE;
+
+	mutex_lock(&icoc8Lock);
+	if (icoc8Spi == NULL)
+		ret = -ENODEV;
+	else if (copy_from_user(icoc8Buf, buf, count))
+		ret = -EFAULT;
+	else
+	{
+		ret = spi_write(icoc8Spi, icoc8Buf, count);
+		if (ret == 0)
+		{
+			icoc8_strobe();
+			ret = count;
+		}
+	}
+	mutex_unlock(&icoc8Lock);
+
+	return ret;
+}
+
 /*-----------------------------------------------------------------------------
  * icoc8_ioctl()
  *---------------------------------------------------------------------------*/
 int icoc8_ioctl(struct inode *inode, struct file *file, unsigned int cmd, unsigned long arg)
 {
 	DRVMSG drvMsg;
-	int ret, regval;
+	int ret;
 	
 	switch (cmd)
 	{
 		// **************** IOCTL_ICOC8_STROBE ****************
 		case IOCTL_ICOC8_STROBE:
 			
-			writel(IOSTROBE, basePioA+PIO_CODR);
-			udelay(100);
-			writel(IOSTROBE, basePioA+PIO_SODR);
+			mutex_lock(&icoc8Lock);
+			icoc8_strobe();
+			mutex_unlock(&icoc8Lock);
 			break;
 	
 		// **************** IOCTL_ICOC8_GETIOBACK ****************
 		case IOCTL_ICOC8_GETIOBACK:
 	
-			drvMsg.ioback = ((readl(basePioA+PIO_PDSR)&IOBACK)>0); 
+			drvMsg.ioback = icoc8_get_ioback(); 
 			ret=copy_to_user((void*)arg,&drvMsg, sizeof(drvMsg));
 			break;
 
@@ -107,18 +599,114 @@ int icoc8_ioctl(struct inode *inode, struct file *file, unsigned int cmd, unsign
 			if(ret)	
 				return -EFAULT;
 
-			writel(NPCS00,(drvMsg.chipsel & 0x01)?basePioA+PIO_SODR:basePioA+PIO_CODR);
-			writel(NPCS01,(drvMsg.chipsel & 0x02)?basePioC+PIO_SODR:basePioC+PIO_CODR);
-			writel(NPCS02,(drvMsg.chipsel & 0x04)?basePioC+PIO_SODR:basePioC+PIO_CODR);
-			writel(NPCS03,(drvMsg.chipsel & 0x08)?basePioC+PIO_SODR:basePioC+PIO_CODR);
+			mutex_lock(&icoc8Lock);
+			icoc8_set_cs(drvMsg.chipsel);
+			mutex_unlock(&icoc8Lock);
+			break;
+
+		// **************** IOCTL_ICOC8_DETECT ****************
+		case IOCTL_ICOC8_DETECT:
+
+			mutex_lock(&icoc8Lock);
+			ret = icoc8Spi ? icoc8_detect() : -ENODEV;
+			mutex_unlock(&icoc8Lock);
+			if (ret)
+				return ret;
+			// fall through
+
+		// **************** IOCTL_ICOC8_GETINFO ****************
+		case IOCTL_ICOC8_GETINFO:
+
+			ret=copy_to_user((void*)arg,&icoc8Info, sizeof(icoc8Info));
+			if (ret)
+				return -EFAULT;
+			break;
+
+		// **************** IOCTL_ICOC8_SETSCAN ****************
+		case IOCTL_ICOC8_SETSCAN:
+
+			// scan period in ms, 0 stops the scanner
+			scanMs = arg;
+			scanKick = 1;
+			wake_up_interruptible(&scanWait);
 			break;
 
+		// **************** IOCTL_ICOC8_XFER ****************
+		case IOCTL_ICOC8_XFER:
+
+			return icoc8_xfer_batch((ICOC8BATCH __user *)arg);
+
 		default:
 			return -EFAULT;
 	}
 	return 0;
 }
 
+/*-----------------------------------------------------------------------------
+ * icoc8_probe()
+ *
+ * Called by the SPI core for the IC8/OC8 bus device of the board.
+ *---------------------------------------------------------------------------*/
+static int __devinit icoc8_probe(struct spi_device *spi)
+{
+	int ret;
+
+	spi->mode = SPI_MODE_3;
+	spi->bits_per_word = 8;
+	if (spi->max_speed_hz > ICOC8_SPI_SPEED)
+		spi->max_speed_hz = ICOC8_SPI_SPEED;
+	ret = spi_setup(spi);
+	if (ret)
+		return ret;
+
+	mutex_lock(&icoc8Lock);
+	icoc8Spi = spi;
+	ret = icoc8_detect();
+	mutex_unlock(&icoc8Lock);
+	if (ret)
+		printk("<0>icoc8: module detection failed (%d)\n", ret);
+
+	// start the IC8 input scanner
+	scanTask = kthread_run(icoc8_scan_thread, NULL, "icoc8scan");
+	if (IS_ERR(scanTask))
+	{
+		ret = PTR_ERR(scanTask);
+		scanTask = NULL;
+		mutex_lock(&icoc8Lock);
+		icoc8Spi = NULL;
+		mutex_unlock(&icoc8Lock);
+		return ret;
+	}
+
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * icoc8_remove()
+ *---------------------------------------------------------------------------*/
+static int __devexit icoc8_remove(struct spi_device *spi)
+{
+	kthread_stop(scanTask);
+	scanTask = NULL;
+
+	mutex_lock(&icoc8Lock);
+	icoc8Spi = NULL;
+	mutex_unlock(&icoc8Lock);
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ * SPI protocol driver
+ *---------------------------------------------------------------------------*/
+static struct spi_driver icoc8_spi_driver = {
+	driver: {
+		name:		"icoc8",
+		owner:	THIS_MODULE,
+	},
+	probe:	icoc8_probe,
+	remove:	__devexit_p(icoc8_remove),
+};
+
 /*-----------------------------------------------------------------------------
  * icoc8_init()
  *---------------------------------------------------------------------------*/
@@ -126,6 +714,11 @@ int icoc8_init(void)
 {
 	int res;
 
+	// DMA safe buffer for SPI transfers
+	icoc8Buf = kmalloc(ICOC8_MAX_OC8, GFP_KERNEL);
+	if (icoc8Buf == NULL)
+		return -ENOMEM;
+
 	// register memory base 
 	basePioA = ioremap_nocache(BASE_AT91_PIOA,0x200);
 	basePioC = ioremap_nocache(BASE_AT91_PIOC,0x200);
@@ -134,6 +727,9 @@ int icoc8_init(void)
 	res = register_chrdev(ICOC8_MAJOR, "icoc8", &icoc8_fops);
 	if (res < 0) {
 		printk("<0>icoc8: cannot register major number %d\n", ICOC8_MAJOR);
+		iounmap(basePioA);
+		iounmap(basePioC);
+		kfree(icoc8Buf);
 		return res;
 	}
 
@@ -146,6 +742,21 @@ int icoc8_init(void)
 	writel(NPCS01|NPCS02|NPCS03, basePioC+PIO_PER);
 	writel(NPCS01|NPCS02|NPCS03, basePioC+PIO_OER);
 
+	// no IC8 addressed, strobe inactive
+	icoc8_set_cs(ICOC8_CS_IDLE);
+	writel(IOSTROBE, basePioA+PIO_SODR);
+
+	// bind to the IC8/OC8 bus device
+	res = spi_register_driver(&icoc8_spi_driver);
+	if (res < 0) {
+		printk("<0>icoc8: cannot register SPI driver\n");
+		unregister_chrdev(ICOC8_MAJOR, "icoc8");
+		iounmap(basePioA);
+		iounmap(basePioC);
+		kfree(icoc8Buf);
+		return res;
+	}
+
 	// everything initialized
 	printk("<0>icoc8: module initialized\n");
 	return 0;
@@ -156,10 +767,13 @@ int icoc8_init(void)
  *---------------------------------------------------------------------------*/
 void icoc8_exit(void) 
 {
+	spi_unregister_driver(&icoc8_spi_driver);
 	unregister_chrdev(ICOC8_MAJOR, "icoc8");
 
-	/* unmap basePioA */
+	/* unmap basePioA and basePioC */
 	iounmap(basePioA);
+	iounmap(basePioC);
+	kfree(icoc8Buf);
 	
 	printk("<0>icoc8: module removed\n");
 }
@@ -21,6 +21,10 @@ extern "C" {
 
 #define ICOC8_MAJOR						63
 
+// Maximum sizes for IOCTL_ICOC8_XFER
+#define ICOC8_XFER_MAX					16
+#define ICOC8_BATCH_MAX					32
+
 // Driver data transfer structure
 typedef struct _DRVMSG
 {
@@ -28,11 +32,70 @@ typedef struct _DRVMSG
 	unsigned char chipsel;				// chip-select used for following SPI transfer
 } DRVMSG;
 
+// Bus topology as detected by the driver
+typedef struct _ICOC8INFO
+{
+	unsigned char nrOfOC8;				// number of OC8 modules in the output chain
+	unsigned char nrOfIC8;				// number of IC8 modules answering on the bus
+} ICOC8INFO;
+
+// IC8 input change record returned by read()
+typedef struct _IC8EVENT
+{
+	unsigned int sec;							// sample timestamp (seconds)
+	unsigned int usec;						// sample timestamp (microseconds)
+	unsigned char module;					// IC8 address
+	unsigned char inputs;					// input state of the module
+	unsigned char changed;				// inputs changed since the last record
+	unsigned char flags;					// IC8EVENT_xxx
+} IC8EVENT;
+
+#define IC8EVENT_INITIAL				0x01	// first sample after (re)detection
+#define IC8EVENT_OVERFLOW				0x02	// older records were dropped
+
+// Transfer descriptor for IOCTL_ICOC8_XFER
+typedef struct _ICOC8XFER
+{
+	unsigned char chipsel;				// IC8 address used for this transfer
+	unsigned char txLen;					// bytes sent from tx[]
+	unsigned char rxLen;					// bytes clocked back into rx[] after tx[]
+	unsigned char reserved;
+	unsigned char tx[ICOC8_XFER_MAX];
+	unsigned char rx[ICOC8_XFER_MAX];
+} ICOC8XFER;
+
+// Batch of transfers run back to back without releasing the bus
+typedef struct _ICOC8BATCH
+{
+	unsigned int count;						// number of descriptors in xfer[]
+	ICOC8XFER *xfer;							// descriptors, rx[] is filled in
+} ICOC8BATCH;
+
+// IC8 message codes
+#define IC8_GET0								0x94
+#define IC8_GET1								0x75
+#define IC8_GET2								0x76
+#define IC8_GET3								0x57
+#define IC8_CLEARBUFFER					0x5E
+#define IC8_MODULE							0x99
+#define IC8_RECIERR							0xF5
+
+// Chip-select pattern with no IC8 addressed
+#define ICOC8_CS_IDLE						0x0F
+
+// Maximum number of modules per bus
+#define ICOC8_MAX_OC8						16
+#define ICOC8_MAX_IC8						15
+
 // IOCTL codes
 #define ICOC8_MAGIC							'k'
 #define IOCTL_ICOC8_STROBE 			_IOWR(ICOC8_MAGIC, 0, int)
 #define IOCTL_ICOC8_GETIOBACK		_IOWR(ICOC8_MAGIC, 1, int)
 #define IOCTL_ICOC8_SETCS				_IOWR(ICOC8_MAGIC, 2, int)
+#define IOCTL_ICOC8_GETINFO			_IOWR(ICOC8_MAGIC, 3, int)
+#define IOCTL_ICOC8_DETECT			_IOWR(ICOC8_MAGIC, 4, int)
+#define IOCTL_ICOC8_SETSCAN			_IOWR(ICOC8_MAGIC, 5, int)	// arg: period [ms]
+#define IOCTL_ICOC8_XFER				_IOWR(ICOC8_MAGIC, 6, int)
 
 #ifdef __cplusplus
 } /* extern "C"*/
@@ -21,9 +21,9 @@
 #include <string.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <poll.h>
 #include <linux/types.h>
 #include "icoc8.h"
-#include "../../../include/linux/spi/spidev.h"
 
 static void pabort(const char *s)
 {
@@ -31,110 +31,34 @@ static void pabort(const char *s)
 	abort();
 }
 
-/*-----------------------------------------------------------------------------
- * IC8 message defines
- *---------------------------------------------------------------------------*/
-#define GET0					0x94
-#define GET1					0x75
-#define GET2					0x76
-#define GET3					0x57
-#define CLEARBUFFER		0x5E
-#define IC8MODULE			0x99
-#define RECIERR				0xF5 
-
 /*-----------------------------------------------------------------------------
  * static vars 
  *---------------------------------------------------------------------------*/
-static int icoc8, spidev, nrOfOC8 = 0, nrOfIC8 = 0;
-
-static unsigned char tx[64];						// SPI transfer buffer
-static unsigned char rx[64];						// SPI receive buffer
+static int icoc8, nrOfOC8 = 0, nrOfIC8 = 0;
 
-static struct spi_ioc_transfer tr = {		// SPI data tranfer structure
-		.tx_buf = 0,
-		.rx_buf = 0,
-		.len = 1,
-		.delay_usecs = 0,
-		.speed_hz = 500000,
-		.bits_per_word = 8,
-};
-
-static DRVMSG drvMsg;										// SPI control structure
-
-static uint8_t mode = SPI_MODE_3;
-static uint8_t bits = 8;
-static uint32_t speed = 500000;
+static unsigned char tx[ICOC8_MAX_OC8];	// OC8 output buffer
 
 /*-----------------------------------------------------------------------------
- * setup_spi() 
+ * get_bus_info() 
  *
- * setup SPI for normal transfer
+ * Query the number of OC8 and IC8 modules detected by the driver. 
  *---------------------------------------------------------------------------*/
-void setup_spi()
-{	
-	int ret;
-
-	// SPI mode
-	ret = ioctl(spidev, SPI_IOC_WR_MODE, &mode);
-	if (ret == -1)
-		pabort("can't set spi mode");
-
-	// SPI bits
-	ret = ioctl(spidev, SPI_IOC_WR_BITS_PER_WORD, &bits);
-	if (ret == -1)
-		pabort("can't set bits per word");
-	
-	// SPI speed
-	ret = ioctl(spidev, SPI_IOC_WR_MAX_SPEED_HZ, &speed);
-	if (ret == -1)
-		pabort("can't set max speed hz");
-
-	printf("spi mode: %d\n", mode);
-	printf("bits per word: %d\n", bits);
-	printf("max speed: %d Hz (%d KHz)\n", speed, speed/1000);
-}
-/*-----------------------------------------------------------------------------
- * count_nr_of_oc8() 
- *
- * Clock out 0xFF into OC8 register chain until feedback (MSB=1). 
- *---------------------------------------------------------------------------*/
-int count_nr_of_oc8(void)
+int get_bus_info(void)
 {
+	ICOC8INFO info;
 	int ret;
-	
-	// empty the OC8 shift registers
-	memset(tx,0,16);
-	tr.len = 16;
-	ioctl(spidev, SPI_IOC_MESSAGE(1), &tr);
 
-	// shift 1's into registers until feedback
-	for (nrOfOC8=0; nrOfOC8<16; nrOfOC8++)
+	ret = ioctl(icoc8, IOCTL_ICOC8_GETINFO, &info);
+	if (ret != 0)
 	{
-		// query IOBACK signal state
-		ret = ioctl(icoc8, IOCTL_ICOC8_GETIOBACK, &drvMsg);
-		if (ret != 0)
-		{
-			pabort("Can't get IOBACK signal (IOCTL_ICOC8_GETIOBACK failed)\n");
-			return -1;
-		}
-
-		if (drvMsg.ioback == 1)
-			break;
-
-		// clock next OC8 byte 
-		memset(tx,0xFF,1);
-		tr.len = 1;
-		ret = ioctl(spidev, SPI_IOC_MESSAGE(1), &tr);
-		if (ret != 1)
-		{
-			printf("count_nr_of_oc8: SPI_IOC_MESSAGE failed (ret=%d).\n",ret);
-			return -1;
-		}
+		printf("get_bus_info: IOCTL_ICOC8_GETINFO failed (ret=%d)\n",ret);
+		return 0;
 	}
-	if (nrOfOC8 == 16) 
-		nrOfOC8 = 0;
-	
+	nrOfOC8 = info.nrOfOC8;
+	nrOfIC8 = info.nrOfIC8;
+
 	printf("Detected %d OC8 modules on the bus\r\n",nrOfOC8);
+	printf("Detected %d IC8 modules on the bus\r\n",nrOfIC8);
 	return 1;
 }
 
@@ -146,92 +70,100 @@ int count_nr_of_oc8(void)
 int display_oc8_patterns()
 {
 	int count=0, ret;
-	tx[0] = 0x01;
    
 	while(count<24)
   {
-		// write pattern to OC8 buffer (multiple OC8 with same pattern)
+		// write pattern to OC8 chain and strobe it (multiple OC8 with same pattern)
 		memset(tx,(0x01<<(count++%8)),nrOfOC8);
 		
-		tr.len = nrOfOC8;
-		ret = ioctl(spidev, SPI_IOC_MESSAGE(1), &tr);
+		ret = write(icoc8, tx, nrOfOC8);
 		if (ret != nrOfOC8)
 		{
-			printf("display_oc8_patterns: SPI_IOC_MESSAGE failed (ret=%d).\n",ret);
-			return -1;
-		}
-
-		// --- strobe the OC8 outputs  
-		ret = ioctl(icoc8, IOCTL_ICOC8_STROBE, NULL);	
-		if (ret != 0)
-		{
-			pabort("can't strobe OC8");
-			return -1;
+			printf("display_oc8_patterns: write failed (ret=%d).\n",ret);
+			return 0;
 		}
 		usleep(200000);
 	}
+	return 1;
 }
 /*-----------------------------------------------------------------------------
- * count_nr_of_ic8() 
+ * batch_ic8_scan() 
  *
- * count up CS lines and query SPI bus to see how many IC8 reply.
+ * Address all IC8 addresses with CLEARBUFFER in a single IOCTL_ICOC8_XFER. 
  *---------------------------------------------------------------------------*/
-int count_nr_of_ic8(void)
+int batch_ic8_scan()
 {
+	ICOC8XFER xfer[ICOC8_MAX_IC8];
+	ICOC8BATCH batch;
 	int ret, i;
 
-	// detect number of IC8
-	for (i=0; i<15; i++)
-	{	
-		// setup the chip select  
-		drvMsg.chipsel = i;
-		ret = ioctl(icoc8, IOCTL_ICOC8_SETCS, &drvMsg);	
-		if (ret != 0)
-		{
-			printf("count_nr_of_ic8: IOCTL_ICOC8_SETCS failed (ret=%d)\n",ret);
-			return -1;
-		}
+	memset(xfer, 0, sizeof(xfer));
+	for (i=0; i<ICOC8_MAX_IC8; i++)
+	{
+		xfer[i].chipsel = i;
+		xfer[i].txLen = 1;
+		xfer[i].tx[0] = IC8_CLEARBUFFER;
+		xfer[i].rxLen = 1;
+	}
+	batch.count = ICOC8_MAX_IC8;
+	batch.xfer = xfer;
 
-		// send the CLEARBUFFER message
-		tx[0] = CLEARBUFFER;
-		tr.len = 1;
-		ret = ioctl(spidev, SPI_IOC_MESSAGE(1), &tr);
-		if (ret != 1)
-		{
-			printf("count_nr_of_ic8: SPI_IOC_MESSAGE failed (ret=%d).\n",ret);
-			return -1;
-		}	
+	ret = ioctl(icoc8, IOCTL_ICOC8_XFER, &batch);
+	if (ret != 0)
+	{
+		printf("batch_ic8_scan: IOCTL_ICOC8_XFER failed (ret=%d)\n",ret);
+		return 0;
+	}
 
-		// clock back the answer byte
-		tx[0] = 0;
-		tr.len = 1;
-		ret = ioctl(spidev, SPI_IOC_MESSAGE(1), &tr);
-		if (ret != 1)
-		{
-			printf("count_nr_of_ic8: SPI_IOC_MESSAGE failed (ret=%d).\n",ret);
-			return -1;
-		}	
-	
-		// reset the chip select  
-		drvMsg.chipsel = 0xF;
-		ret = ioctl(icoc8, IOCTL_ICOC8_SETCS, &drvMsg);	
-		if (ret != 0)
+	for (i=0; i<ICOC8_MAX_IC8 && xfer[i].rx[0]==IC8_MODULE; i++)
+		;
+	printf("Batch scan found %d IC8 modules\r\n",i);
+	return 1;
+}
+
+/*-----------------------------------------------------------------------------
+ * monitor_ic8_inputs() 
+ *
+ * Print the input change records of the kernel IC8 scanner for 10 seconds. 
+ *---------------------------------------------------------------------------*/
+int monitor_ic8_inputs()
+{
+	struct pollfd pfd;
+	IC8EVENT ev[8];
+	int ret, i;
+
+	if (nrOfIC8 == 0)
+		return 1;
+
+	pfd.fd = icoc8;
+	pfd.events = POLLIN;
+
+	printf("Please toggle some IC8 inputs!\n");
+	for (;;)
+	{
+		ret = poll(&pfd, 1, 10000);
+		if (ret < 0)
 		{
-			printf("count_nr_of_ic8: IOCTL_ICOC8_SETCS failed (ret=%d)\n",ret);
-			return -1;
+			pabort("poll on icoc8 failed");
+			return 0;
 		}
-		
-		// update IC8 counter
-		if (rx[0]==IC8MODULE)
-			nrOfIC8++;
-		else {
+		if (ret == 0)
 			break;
+
+		ret = read(icoc8, ev, sizeof(ev));
+		if (ret < (int)sizeof(IC8EVENT))
+		{
+			printf("monitor_ic8_inputs: read failed (ret=%d).\n",ret);
+			return 0;
 		}
+		for (i=0; i<ret/(int)sizeof(IC8EVENT); i++)
+			printf("%u.%06u IC8 %d: inputs=0x%02X changed=0x%02X flags=0x%02X\n",
+				ev[i].sec, ev[i].usec, ev[i].module, ev[i].inputs, ev[i].changed,
+				ev[i].flags);
 	}
-	
-	printf("Detected %d IC8 modules on the bus\r\n",nrOfIC8);
 	return 1;
 }
+
 /*-----------------------------------------------------------------------------
  * main program function 
  *---------------------------------------------------------------------------*/
@@ -240,10 +172,6 @@ int main(void)
 	unsigned int data;
 	int ret, i;
 	char icoc8_devname[20] = "/dev/icoc8";
-	char spidev_devname[20] =  "/dev/spidev0.1";
-
-	tr.tx_buf = (unsigned long)tx;
-	tr.rx_buf = (unsigned long)rx;
 
 	printf("Simple ICOC8 driver test program\r\n");
 
@@ -254,28 +182,22 @@ int main(void)
 		return -1;
 	}
 
-	spidev = open((char *)spidev_devname,O_RDWR);
-	if(spidev < 0) {
-		printf("Error opening %s\n",spidev_devname);
+	// *** get number of OC8 and IC8 modules on SPI bus ***
+	if (!get_bus_info()) 
 		return -1;
-	}
 
-	// *** setup SPI ***
-	setup_spi();
-
-	// *** count number of OC8 modules on SPI bus ***
-	if (!count_nr_of_oc8()) 
+	// ***  display LED pattern on OC8 modules ***
+	if (!display_oc8_patterns())
 		return -1;
 
-	// *** count number of IC8 modules on SPI bus ***
-	if (!count_nr_of_ic8())
+	// *** scan IC8 addresses in one batch ***
+	if (!batch_ic8_scan())
 		return -1;
 
-	// ***  display LED pattern on OC8 modules ***
-	if (!display_oc8_patterns())
+	// *** show IC8 input changes ***
+	if (!monitor_ic8_inputs())
 		return -1;
 
-	close(spidev);
 	close(icoc8);
 	return 0;
 }
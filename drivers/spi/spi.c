@@ -401,11 +401,15 @@ static void scan_boardinfo(struct spi_master *master)
 
 /*-------------------------------------------------------------------------*/
 
+/* size of the spi_write_then_read() bounce buffers */
+#define	SPI_BUFSIZ	max(32,SMP_CACHE_BYTES)
+
 static void spi_master_release(struct device *dev)
 {
 	struct spi_master *master;
 
 	master = container_of(dev, struct spi_master, dev);
+	kfree(master->bounce_buf);
 	kfree(master);
 }
 
@@ -446,6 +450,12 @@ struct spi_master *spi_alloc_master(struct device *dev, unsigned size)
 	if (!master)
 		return NULL;
 
+	/* spi_write_then_read() falls back to the global buffer if this
+	 * allocation fails
+	 */
+	mutex_init(&master->bounce_lock);
+	master->bounce_buf = kmalloc(SPI_BUFSIZ, GFP_KERNEL);
+
 	device_initialize(&master->dev);
 	master->dev.class = &spi_master_class;
 	master->dev.parent = get_device(dev);
@@ -627,8 +637,6 @@ int spi_sync(struct spi_device *spi, struct spi_message *message)
 EXPORT_SYMBOL_GPL(spi_sync);
 
 /* portable code must never pass more than 32 bytes */
-#define	SPI_BUFSIZ	max(32,SMP_CACHE_BYTES)
-
 static u8	*buf;
 
 /**
@@ -648,7 +656,8 @@ static u8	*buf;
  * Parameters to this routine are always copied using a small buffer;
  * portable code should never use this for more than 32 bytes.
  * Performance-sensitive or bulk transfer code should instead use
- * spi_{async,sync}() calls with dma-safe buffers.
+ * spi_write_then_read_dma() or spi_{async,sync}() calls with dma-safe
+ * buffers.
  */
 int spi_write_then_read(struct spi_device *spi,
 		const u8 *txbuf, unsigned n_tx,
@@ -656,6 +665,8 @@ int spi_write_then_read(struct spi_device *spi,
 {
 	static DEFINE_MUTEX(lock);
 
+	struct spi_master	*master = spi->master;
+	struct mutex		*lockp;
 	int			status;
 	struct spi_message	message;
 	struct spi_transfer	x[2];
@@ -679,13 +690,24 @@ int spi_write_then_read(struct spi_device *spi,
 		spi_message_add_tail(&x[1], &message);
 	}
 
+	/* ... preferably the one of this controller, so that other
+	 * busses don't contend for it ...
+	 */
+	if (master->bounce_buf) {
+		lockp = &master->bounce_lock;
+		local_buf = master->bounce_buf;
+	} else {
+		lockp = &lock;
+		local_buf = buf;
+	}
+
 	/* ... unless someone else is using the pre-allocated buffer */
-	if (!mutex_trylock(&lock)) {
+	if (!mutex_trylock(lockp)) {
 		local_buf = kmalloc(SPI_BUFSIZ, GFP_KERNEL);
 		if (!local_buf)
 			return -ENOMEM;
-	} else
-		local_buf = buf;
+		lockp = NULL;
+	}
 
 	memcpy(local_buf, txbuf, n_tx);
 	x[0].tx_buf = local_buf;
@@ -696,8 +718,8 @@ int spi_write_then_read(struct spi_device *spi,
 	if (status == 0)
 		memcpy(rxbuf, x[1].rx_buf, n_rx);
 
-	if (x[0].tx_buf == buf)
-		mutex_unlock(&lock);
+	if (lockp)
+		mutex_unlock(lockp);
 	else
 		kfree(local_buf);
 
@@ -124,4 +124,11 @@
 #define ATMEL_US_NER		0x44			/* Number of Errors Register */
 #define ATMEL_US_IF		0x4c			/* IrDA Filter Register */
 
+#ifdef __KERNEL__
+struct tty_struct;
+
+/* worst-case receive delivery latency [us], 0 if not an atmel_serial tty */
+extern unsigned int atmel_serial_rx_latency(struct tty_struct *tty);
+#endif
+
 #endif
@@ -108,6 +108,8 @@ struct memory_accessor {
 			size_t count);
 	ssize_t (*write)(struct memory_accessor *, const char *buf,
 			 off_t offset, size_t count);
+	/* optional: commit buffered writes to the device */
+	int (*sync)(struct memory_accessor *);
 };
 
 /*
@@ -226,6 +226,12 @@ struct uart_ops {
 	void		(*config_port)(struct uart_port *, int);
 	int		(*verify_port)(struct uart_port *, struct serial_struct *);
 	int		(*ioctl)(struct uart_port *, unsigned int, unsigned long);
+
+	/*
+	 * Optional: sleep until the transmitter is empty or 'timeout'
+	 * jiffies have passed, instead of polling tx_empty().
+	 */
+	void		(*wait_tx_empty)(struct uart_port *, unsigned long timeout);
 #ifdef CONFIG_CONSOLE_POLL
 	void	(*poll_put_char)(struct uart_port *, unsigned char);
 	int		(*poll_get_char)(struct uart_port *);
@@ -20,6 +20,7 @@
 #define __LINUX_SPI_H
 
 #include <linux/device.h>
+#include <linux/mutex.h>
 
 /*
  * INTERFACES between SPI master-side drivers and SPI infrastructure.
@@ -212,6 +213,9 @@ static inline void spi_unregister_driver(struct spi_driver *sdrv)
  *	the device whose settings are being modified.
  * @transfer: adds a message to the controller's transfer queue.
  * @cleanup: frees controller-specific state
+ * @bounce_lock: serializes users of @bounce_buf
+ * @bounce_buf: preallocated DMA-safe buffer used by spi_write_then_read()
+ *	for the devices on this controller
  *
  * Each SPI master controller can communicate with one or more @spi_device
  * children.  These make a small bus, sharing MOSI, MISO and SCK signals
@@ -277,6 +281,12 @@ struct spi_master {
 
 	/* called on release() to free memory provided by spi_master */
 	void			(*cleanup)(struct spi_device *spi);
+
+	/* private to spi_write_then_read(); one buffer per controller,
+	 * so that unrelated busses don't contend for it
+	 */
+	struct mutex		bounce_lock;
+	u8			*bounce_buf;
 };
 
 static inline void *spi_master_get_devdata(struct spi_master *master)
@@ -646,6 +656,43 @@ extern int spi_write_then_read(struct spi_device *spi,
 		const u8 *txbuf, unsigned n_tx,
 		u8 *rxbuf, unsigned n_rx);
 
+/**
+ * spi_write_then_read_dma - SPI synchronous write followed by read
+ * @spi: device with which data will be exchanged
+ * @txbuf: data to be written (must be dma-safe)
+ * @n_tx: size of txbuf, in bytes
+ * @rxbuf: buffer into which data will be read (must be dma-safe)
+ * @n_rx: size of rxbuf, in bytes
+ * Context: can sleep
+ *
+ * Like spi_write_then_read(), but without copying the data through a
+ * bounce buffer and without any size limit.  Callable only from
+ * contexts that can sleep.
+ */
+static inline int
+spi_write_then_read_dma(struct spi_device *spi,
+		const u8 *txbuf, unsigned n_tx,
+		u8 *rxbuf, unsigned n_rx)
+{
+	struct spi_transfer	x[2] = {
+		{
+			.tx_buf		= txbuf,
+			.len		= n_tx,
+		}, {
+			.rx_buf		= rxbuf,
+			.len		= n_rx,
+		},
+	};
+	struct spi_message	m;
+
+	spi_message_init(&m);
+	if (n_tx)
+		spi_message_add_tail(&x[0], &m);
+	if (n_rx)
+		spi_message_add_tail(&x[1], &m);
+	return spi_sync(spi, &m);
+}
+
 /**
  * spi_w8r8 - SPI synchronous 8 bit write followed by 8 bit read
  * @spi: device with which data will be exchanged